@@ -0,0 +1,137 @@
+/**
+ * Compares loading a set of images from loose files with loading them from
+ * an asset pack made by gcnpack, both cold (the files evicted from the
+ * operating system's page cache first) and warm.
+ *
+ * Usage: packstartup <images.pack> <image>...
+ *
+ * The images must be given the same way they were given to gcnpack.
+ * Evicting the page cache needs posix_fadvise(); elsewhere the cold runs
+ * are warm as well.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <guichan/exception.hpp>
+#include <guichan/image.hpp>
+#include <guichan/sfml/sfmlimageloader.hpp>
+#include <guichan/sfml/sfmlpackimageloader.hpp>
+
+#include <SFML/Graphics.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    void evict(const std::string& filename)
+    {
+#if defined(POSIX_FADV_DONTNEED)
+        const int file = open(filename.c_str(), O_RDONLY);
+
+        if (file >= 0)
+        {
+            fdatasync(file);
+            posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+            close(file);
+        }
+#else
+        (void)filename;
+#endif
+    }
+
+    double loadAll(gcn::SFMLImageLoader& loader, const std::vector<std::string>& filenames)
+    {
+        std::vector<gcn::Image*> images;
+        sf::Clock clock;
+
+        for (std::size_t i = 0; i < filenames.size(); ++i)
+        {
+            images.push_back(loader.load(filenames[i]));
+        }
+
+        const double elapsed = clock.getElapsedTime().asSeconds() * 1000.0;
+
+        for (std::size_t i = 0; i < images.size(); ++i)
+        {
+            delete images[i];
+        }
+
+        return elapsed;
+    }
+
+    double runLoose(const std::vector<std::string>& filenames, bool cold)
+    {
+        if (cold)
+        {
+            for (std::size_t i = 0; i < filenames.size(); ++i)
+            {
+                evict(filenames[i]);
+            }
+        }
+
+        gcn::SFMLImageLoader loader;
+
+        return loadAll(loader, filenames);
+    }
+
+    double runPack(const std::string& pack, const std::vector<std::string>& filenames, bool cold)
+    {
+        if (cold)
+        {
+            evict(pack);
+        }
+
+        sf::Clock clock;
+
+        gcn::SFMLPackImageLoader loader(pack);
+        loader.setFallbackEnabled(false);
+
+        const double opening = clock.getElapsedTime().asSeconds() * 1000.0;
+
+        return opening + loadAll(loader, filenames);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "Usage: %s <images.pack> <image>...\n", argv[0]);
+        return 1;
+    }
+
+    const std::string pack = argv[1];
+    const std::vector<std::string> filenames(argv + 2, argv + argc);
+
+    // Creates the OpenGL context up front so it isn't counted.
+    sf::Texture warmup;
+    warmup.create(1, 1);
+
+    try
+    {
+        const double looseCold = runLoose(filenames, true);
+        const double looseWarm = runLoose(filenames, false);
+        const double packCold = runPack(pack, filenames, true);
+        const double packWarm = runPack(pack, filenames, false);
+
+        std::printf("images:          %u\n", static_cast<unsigned int>(filenames.size()));
+        std::printf("loose cold:      %.3f ms\n", looseCold);
+        std::printf("loose warm:      %.3f ms\n", looseWarm);
+        std::printf("pack cold:       %.3f ms\n", packCold);
+        std::printf("pack warm:       %.3f ms\n", packWarm);
+        std::printf("cold speedup:    %.2fx\n", looseCold / packCold);
+        std::printf("warm speedup:    %.2fx\n", looseWarm / packWarm);
+    }
+    catch (const gcn::Exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.getMessage().c_str());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,339 @@
+/**
+ * Measures the throughput of the drawing primitives of SFMLGraphics at
+ * several clip stack depths, rendering into an sf::RenderTexture. No window
+ * is opened; a software OpenGL implementation such as Mesa's llvmpipe is
+ * enough (LIBGL_ALWAYS_SOFTWARE=1, under xvfb-run where there is no
+ * display).
+ *
+ * Usage: primitives [--font <font.ttf>] [--time <ms>] [--baseline <file>] [--tolerance <percent>]
+ *
+ * Prints one tab separated line per primitive and clip depth:
+ *
+ *     primitive  depth  calls  ns_per_call  calls_per_second
+ *
+ * The output can be saved as a baseline. With --baseline every case is
+ * compared against the baseline and the change in ns per call is appended;
+ * the exit code is 2 if any case got slower than the tolerance (10% by
+ * default) allows. drawText is only measured when a font is given.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <guichan/exception.hpp>
+#include <guichan/rectangle.hpp>
+#include <guichan/sfml.hpp>
+
+#include <SFML/Graphics.hpp>
+
+namespace
+{
+    const unsigned int WIDTH = 1024;
+    const unsigned int HEIGHT = 768;
+    const unsigned int CALLS_PER_FRAME = 1000;
+    const unsigned int CLIP_DEPTHS[] = { 1, 4, 16 };
+
+    enum Primitive
+    {
+        FillRectangle,
+        DrawRectangle,
+        DrawHorizontalLine,
+        DrawDiagonalLine,
+        DrawPoint,
+        DrawImage,
+        DrawText
+    };
+
+    const char* const PRIMITIVE_NAMES[] =
+    {
+        "fillRectangle",
+        "drawRectangle",
+        "drawLine.horizontal",
+        "drawLine.diagonal",
+        "drawPoint",
+        "drawImage",
+        "drawText"
+    };
+
+    struct Result
+    {
+        unsigned long calls;
+        double nsPerCall;
+    };
+
+    /**
+     * Issues one call of a primitive. The positions wander over the target
+     * so the calls aren't all identical.
+     */
+    void drawPrimitive(gcn::SFMLGraphics& graphics, Primitive primitive, unsigned int i, gcn::Image* image)
+    {
+        const int x = static_cast<int>((i * 37) % (WIDTH - 64));
+        const int y = static_cast<int>((i * 53) % (HEIGHT - 64));
+
+        switch (primitive)
+        {
+            case FillRectangle:
+                graphics.fillRectangle(gcn::Rectangle(x, y, 48, 24));
+                break;
+            case DrawRectangle:
+                graphics.drawRectangle(gcn::Rectangle(x, y, 48, 24));
+                break;
+            case DrawHorizontalLine:
+                graphics.drawLine(x, y, x + 48, y);
+                break;
+            case DrawDiagonalLine:
+                graphics.drawLine(x, y, x + 48, y + 24);
+                break;
+            case DrawPoint:
+                graphics.drawPoint(x, y);
+                break;
+            case DrawImage:
+                graphics.drawImage(image, 0, 0, x, y, 32, 32);
+                break;
+            case DrawText:
+                graphics.drawText("The quick brown fox", x, y);
+                break;
+        }
+    }
+
+    /**
+     * Draws frames of one primitive until the time is up.
+     */
+    Result measure(sf::RenderTexture& target,
+                   gcn::SFMLGraphics& graphics,
+                   Primitive primitive,
+                   unsigned int depth,
+                   gcn::Image* image,
+                   double milliseconds)
+    {
+        Result result;
+        result.calls = 0;
+
+        sf::Clock clock;
+        unsigned int i = 0;
+        bool warmedUp = false;
+
+        while (true)
+        {
+            graphics._beginDraw();
+
+            // The root clip area is one level; each further level is inset
+            // a little so clipping has something to do.
+            for (unsigned int level = 1; level < depth; ++level)
+            {
+                graphics.pushClipArea(gcn::Rectangle(1, 1, WIDTH - level * 2, HEIGHT - level * 2));
+            }
+
+            for (unsigned int call = 0; call < CALLS_PER_FRAME; ++call)
+            {
+                drawPrimitive(graphics, primitive, i++, image);
+            }
+
+            for (unsigned int level = 1; level < depth; ++level)
+            {
+                graphics.popClipArea();
+            }
+
+            graphics._endDraw();
+            target.display();
+
+            // The first frame uploads glyph pages and the like.
+            if (!warmedUp)
+            {
+                target.getTexture().copyToImage();
+                warmedUp = true;
+                clock.restart();
+                continue;
+            }
+
+            result.calls += CALLS_PER_FRAME;
+
+            if (clock.getElapsedTime().asSeconds() * 1000.0 >= milliseconds)
+            {
+                break;
+            }
+        }
+
+        // Waits for the GPU to finish, so queued work is counted as well.
+        target.getTexture().copyToImage();
+
+        result.nsPerCall = clock.getElapsedTime().asSeconds() * 1.0e9 / result.calls;
+
+        return result;
+    }
+
+    /**
+     * Reads the ns per call of each case from a previous run.
+     */
+    bool readBaseline(const std::string& filename, std::map<std::string, double>& baseline)
+    {
+        std::ifstream file(filename.c_str());
+
+        if (!file)
+        {
+            return false;
+        }
+
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+
+            std::istringstream fields(line);
+            std::string primitive;
+            unsigned int depth = 0;
+            unsigned long calls = 0;
+            double nsPerCall = 0.0;
+
+            if (fields >> primitive >> depth >> calls >> nsPerCall)
+            {
+                std::ostringstream key;
+                key << primitive << "/" << depth;
+                baseline[key.str()] = nsPerCall;
+            }
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string fontFilename;
+    std::string baselineFilename;
+    double milliseconds = 500.0;
+    double tolerance = 10.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--font") == 0 && i + 1 < argc)
+        {
+            fontFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+        {
+            milliseconds = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baselineFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            tolerance = std::atof(argv[++i]);
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--font <font.ttf>] [--time <ms>] [--baseline <file>] [--tolerance <percent>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+
+    if (!baselineFilename.empty() && !readBaseline(baselineFilename, baseline))
+    {
+        std::fprintf(stderr, "Unable to read baseline \"%s\"\n", baselineFilename.c_str());
+        return 1;
+    }
+
+    sf::RenderTexture target;
+
+    if (!target.create(WIDTH, HEIGHT))
+    {
+        std::fprintf(stderr, "Unable to create a render texture\n");
+        return 1;
+    }
+
+    bool regressed = false;
+
+    try
+    {
+        gcn::SFMLGraphics graphics(target);
+        graphics.setColor(gcn::Color(200, 100, 50));
+
+        // A generated image, so no files are needed.
+        sf::Image pixels;
+        pixels.create(64, 64, sf::Color(80, 160, 240));
+
+        sf::Texture* texture = new sf::Texture();
+        texture->loadFromImage(pixels);
+
+        gcn::SFMLImage image(texture, true);
+
+        gcn::SFMLFont* font = NULL;
+
+        if (!fontFilename.empty())
+        {
+            font = new gcn::SFMLFont(fontFilename, 12);
+            graphics.setFont(font);
+        }
+
+        std::printf("# primitive\tdepth\tcalls\tns_per_call\tcalls_per_second%s\n",
+                    baseline.empty() ? "" : "\tchange_percent");
+
+        for (int primitive = FillRectangle; primitive <= DrawText; ++primitive)
+        {
+            if (primitive == DrawText && font == NULL)
+            {
+                continue;
+            }
+
+            for (std::size_t d = 0; d < sizeof(CLIP_DEPTHS) / sizeof(CLIP_DEPTHS[0]); ++d)
+            {
+                const unsigned int depth = CLIP_DEPTHS[d];
+                const Result result = measure(target,
+                                              graphics,
+                                              static_cast<Primitive>(primitive),
+                                              depth,
+                                              &image,
+                                              milliseconds);
+
+                std::printf("%s\t%u\t%lu\t%.1f\t%.0f",
+                            PRIMITIVE_NAMES[primitive],
+                            depth,
+                            result.calls,
+                            result.nsPerCall,
+                            1.0e9 / result.nsPerCall);
+
+                std::ostringstream key;
+                key << PRIMITIVE_NAMES[primitive] << "/" << depth;
+                std::map<std::string, double>::const_iterator previous = baseline.find(key.str());
+
+                if (previous != baseline.end())
+                {
+                    const double change = (result.nsPerCall - previous->second) * 100.0 / previous->second;
+
+                    std::printf("\t%+.1f", change);
+
+                    if (change > tolerance)
+                    {
+                        std::printf("\tREGRESSION");
+                        regressed = true;
+                    }
+                }
+
+                std::printf("\n");
+                std::fflush(stdout);
+            }
+        }
+
+        delete font;
+    }
+    catch (const gcn::Exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.getMessage().c_str());
+        return 1;
+    }
+
+    return regressed ? 2 : 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * Draws a screen of 500 static labels with the text geometry cache of
+ * SFMLFont disabled and enabled, and prints the time per frame of each.
+ *
+ * Usage: textcache <font.ttf> [frames]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <guichan/exception.hpp>
+#include <guichan/sfml.hpp>
+#include <guichan/gui.hpp>
+#include <guichan/widgets/container.hpp>
+#include <guichan/widgets/label.hpp>
+
+#include <SFML/Graphics.hpp>
+
+namespace
+{
+    const unsigned int LABEL_COUNT = 500;
+    const unsigned int COLUMNS = 5;
+    const unsigned int FONT_SIZE = 12;
+    const unsigned int WIDTH = 1000;
+    // Rows are one font height apart, so the labels don't overlap.
+    const unsigned int HEIGHT = (LABEL_COUNT / COLUMNS) * FONT_SIZE;
+
+    double runFrames(gcn::Gui& gui, sf::RenderTexture& target, unsigned int frames)
+    {
+        // One frame to warm up glyph pages and, if enabled, the cache.
+        target.clear();
+        gui.draw();
+        target.display();
+
+        sf::Clock clock;
+
+        for (unsigned int i = 0; i < frames; ++i)
+        {
+            target.clear();
+            gui.draw();
+            target.display();
+        }
+
+        return clock.getElapsedTime().asSeconds() * 1000.0 / frames;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <font.ttf> [frames]\n", argv[0]);
+        return 1;
+    }
+
+    const unsigned int frames = argc > 2 ? std::atoi(argv[2]) : 200;
+
+    sf::RenderTexture target;
+
+    if (!target.create(WIDTH, HEIGHT))
+    {
+        std::fprintf(stderr, "Unable to create a render texture\n");
+        return 1;
+    }
+
+    try
+    {
+        gcn::SFMLGraphics graphics(target);
+        gcn::SFMLFont font(argv[1], FONT_SIZE);
+
+        gcn::Widget::setGlobalFont(&font);
+
+        gcn::Gui gui;
+        gcn::Container top;
+
+        top.setSize(WIDTH, HEIGHT);
+        top.setOpaque(false);
+        gui.setGraphics(&graphics);
+        gui.setTop(&top);
+
+        std::vector<gcn::Label*> labels;
+
+        for (unsigned int i = 0; i < LABEL_COUNT; ++i)
+        {
+            std::ostringstream caption;
+            caption << "Label " << i << ": the quick brown fox";
+
+            gcn::Label* label = new gcn::Label(caption.str());
+            label->adjustSize();
+            top.add(label, (i % COLUMNS) * (WIDTH / COLUMNS), (i / COLUMNS) * font.getHeight());
+            labels.push_back(label);
+        }
+
+        font.setGeometryCacheSize(0);
+        const double uncached = runFrames(gui, target, frames);
+
+        font.setGeometryCacheSize(LABEL_COUNT * 2);
+        const double cached = runFrames(gui, target, frames);
+
+        std::printf("labels:          %u\n", LABEL_COUNT);
+        std::printf("frames:          %u\n", frames);
+        std::printf("uncached:        %.3f ms/frame\n", uncached);
+        std::printf("cached:          %.3f ms/frame\n", cached);
+        std::printf("speedup:         %.2fx\n", uncached / cached);
+        std::printf("cache hits:      %u\n", font.getGeometryCacheHits());
+        std::printf("cache misses:    %u\n", font.getGeometryCacheMisses());
+
+        for (std::size_t i = 0; i < labels.size(); ++i)
+        {
+            delete labels[i];
+        }
+    }
+    catch (const gcn::Exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.getMessage().c_str());
+        return 1;
+    }
+
+    return 0;
+}
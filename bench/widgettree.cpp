@@ -0,0 +1,346 @@
+/**
+ * Measures how frame time grows with the size of the GUI. Synthetic trees
+ * of buttons, labels, icons and list boxes, from 100 to 100000 widgets,
+ * are driven through SFMLInput, SFMLGraphics and SFMLFont into an
+ * sf::RenderTexture, at several nesting depths: at depth d every widget
+ * sits inside d containers.
+ *
+ * Usage: widgettree <font.ttf> [--frames <n>] [--max-widgets <n>]
+ *
+ * Prints one tab separated line per widget count and depth with the 50th,
+ * 90th and 99th percentile and the maximum of the frame times. A line is
+ * flagged SUPERLINEAR when its median grew faster than the widget count
+ * raised to the power of 1.2 since the previous count at the same depth,
+ * and the exit code is then 2.
+ * Runs without a GPU on Mesa's llvmpipe, like the primitives benchmark.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <guichan/exception.hpp>
+#include <guichan/gui.hpp>
+#include <guichan/listmodel.hpp>
+#include <guichan/sfml.hpp>
+#include <guichan/widgets/button.hpp>
+#include <guichan/widgets/container.hpp>
+#include <guichan/widgets/icon.hpp>
+#include <guichan/widgets/label.hpp>
+#include <guichan/widgets/listbox.hpp>
+
+#include <SFML/Graphics.hpp>
+
+namespace
+{
+    const unsigned int WIDTH = 1024;
+    const unsigned int HEIGHT = 768;
+    const unsigned int CELL_WIDTH = 96;
+    const unsigned int CELL_HEIGHT = 48;
+    const unsigned int COLUMNS = WIDTH / CELL_WIDTH;
+    const unsigned int WIDGET_COUNTS[] = { 100, 1000, 10000, 100000 };
+    const unsigned int DEPTHS[] = { 1, 4, 16 };
+
+    // A median growing by more than count^SUPERLINEAR_EXPONENT is flagged.
+    const double SUPERLINEAR_EXPONENT = 1.2;
+
+    class NumberListModel : public gcn::ListModel
+    {
+    public:
+        int getNumberOfElements()
+        {
+            return 4;
+        }
+
+        std::string getElementAt(int i)
+        {
+            std::ostringstream element;
+            element << "Item " << i;
+            return element.str();
+        }
+    };
+
+    /**
+     * A tree of widgets and the containers holding them.
+     */
+    class WidgetTree
+    {
+    public:
+        WidgetTree(unsigned int widgetCount,
+                   unsigned int depth,
+                   const gcn::Image* image,
+                   gcn::ListModel* listModel)
+        {
+            const unsigned int rows = (widgetCount + COLUMNS - 1) / COLUMNS;
+
+            mTop.setSize(WIDTH, rows * CELL_HEIGHT);
+            mTop.setOpaque(false);
+
+            for (unsigned int i = 0; i < widgetCount; ++i)
+            {
+                gcn::Widget* widget = createWidget(i, image, listModel);
+                mWidgets.push_back(widget);
+
+                // Every widget gets a chain of depth - 1 containers of its
+                // own below the top container.
+                gcn::Container* parent = &mTop;
+                int x = static_cast<int>((i % COLUMNS) * CELL_WIDTH);
+                int y = static_cast<int>((i / COLUMNS) * CELL_HEIGHT);
+
+                for (unsigned int level = 1; level < depth; ++level)
+                {
+                    gcn::Container* container = new gcn::Container();
+                    container->setSize(CELL_WIDTH - level, CELL_HEIGHT - level);
+                    container->setOpaque(false);
+                    parent->add(container, x, y);
+                    mContainers.push_back(container);
+
+                    parent = container;
+                    x = 1;
+                    y = 1;
+                }
+
+                parent->add(widget, x, y);
+            }
+        }
+
+        ~WidgetTree()
+        {
+            for (std::size_t i = 0; i < mWidgets.size(); ++i)
+            {
+                delete mWidgets[i];
+            }
+
+            for (std::size_t i = mContainers.size(); i > 0; --i)
+            {
+                delete mContainers[i - 1];
+            }
+        }
+
+        gcn::Container* getTop()
+        {
+            return &mTop;
+        }
+
+    private:
+        gcn::Widget* createWidget(unsigned int i, const gcn::Image* image, gcn::ListModel* listModel)
+        {
+            std::ostringstream caption;
+            caption << "Widget " << i;
+
+            gcn::Widget* widget = NULL;
+
+            switch (i % 4)
+            {
+                case 0:
+                    widget = new gcn::Button(caption.str());
+                    break;
+                case 1:
+                    widget = new gcn::Label(caption.str());
+                    break;
+                case 2:
+                    widget = new gcn::Icon(image);
+                    break;
+                default:
+                {
+                    gcn::ListBox* listBox = new gcn::ListBox(listModel);
+                    listBox->setSelected(i % 4);
+                    widget = listBox;
+                    break;
+                }
+            }
+
+            widget->setSize(CELL_WIDTH - 24, CELL_HEIGHT - 24);
+
+            return widget;
+        }
+
+        gcn::Container mTop;
+        std::vector<gcn::Widget*> mWidgets;
+        std::vector<gcn::Container*> mContainers; // Outer containers first
+    };
+
+    /**
+     * Sends a mouse move, and every few frames a click, to the GUI.
+     */
+    void pushSyntheticInput(gcn::SFMLInput& input, const sf::RenderTarget& target, unsigned int frame)
+    {
+        sf::Event event;
+        event.type = sf::Event::MouseMoved;
+        event.mouseMove.x = static_cast<int>((frame * 37) % WIDTH);
+        event.mouseMove.y = static_cast<int>((frame * 23) % HEIGHT);
+        input.pushInput(event, target);
+
+        if (frame % 8 == 0)
+        {
+            sf::Event button;
+            button.mouseButton.button = sf::Mouse::Left;
+            button.mouseButton.x = event.mouseMove.x;
+            button.mouseButton.y = event.mouseMove.y;
+
+            button.type = sf::Event::MouseButtonPressed;
+            input.pushInput(button, target);
+            button.type = sf::Event::MouseButtonReleased;
+            input.pushInput(button, target);
+        }
+    }
+
+    double percentile(const std::vector<double>& sorted, double fraction)
+    {
+        const std::size_t index = static_cast<std::size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[index];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <font.ttf> [--frames <n>] [--max-widgets <n>]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int frames = 60;
+    unsigned int maxWidgets = 100000;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frames = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "--max-widgets") == 0 && i + 1 < argc)
+        {
+            maxWidgets = std::atoi(argv[++i]);
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s <font.ttf> [--frames <n>] [--max-widgets <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    sf::RenderTexture target;
+
+    if (!target.create(WIDTH, HEIGHT))
+    {
+        std::fprintf(stderr, "Unable to create a render texture\n");
+        return 1;
+    }
+
+    bool superlinear = false;
+
+    try
+    {
+        gcn::SFMLGraphics graphics(target);
+        gcn::SFMLFont font(argv[1], 12);
+        gcn::SFMLInput input;
+
+        gcn::Widget::setGlobalFont(&font);
+
+        sf::Image pixels;
+        pixels.create(24, 24, sf::Color(80, 160, 240));
+
+        sf::Texture* texture = new sf::Texture();
+        texture->loadFromImage(pixels);
+
+        gcn::SFMLImage image(texture, true);
+        NumberListModel listModel;
+
+        std::printf("# widgets\tdepth\tframes\tp50_ms\tp90_ms\tp99_ms\tmax_ms\n");
+
+        for (std::size_t d = 0; d < sizeof(DEPTHS) / sizeof(DEPTHS[0]); ++d)
+        {
+            const unsigned int depth = DEPTHS[d];
+            unsigned int previousCount = 0;
+            double previousMedian = 0.0;
+
+            for (std::size_t c = 0; c < sizeof(WIDGET_COUNTS) / sizeof(WIDGET_COUNTS[0]); ++c)
+            {
+                const unsigned int widgetCount = WIDGET_COUNTS[c];
+
+                if (widgetCount > maxWidgets)
+                {
+                    break;
+                }
+
+                WidgetTree tree(widgetCount, depth, &image, &listModel);
+
+                gcn::Gui gui;
+                gui.setGraphics(&graphics);
+                gui.setInput(&input);
+                gui.setTop(tree.getTop());
+
+                std::vector<double> times;
+
+                // The first frame builds glyph pages and caches.
+                for (unsigned int frame = 0; frame <= frames; ++frame)
+                {
+                    sf::Clock clock;
+
+                    pushSyntheticInput(input, target, frame);
+                    gui.logic();
+
+                    target.clear();
+                    gui.draw();
+                    target.display();
+
+                    if (frame > 0)
+                    {
+                        times.push_back(clock.getElapsedTime().asSeconds() * 1000.0);
+                    }
+                }
+
+                // Waits for the GPU before the tree is torn down.
+                target.getTexture().copyToImage();
+
+                std::sort(times.begin(), times.end());
+
+                const double median = percentile(times, 0.5);
+
+                std::printf("%u\t%u\t%u\t%.3f\t%.3f\t%.3f\t%.3f",
+                            widgetCount,
+                            depth,
+                            frames,
+                            median,
+                            percentile(times, 0.9),
+                            percentile(times, 0.99),
+                            times.back());
+
+                // Compares the growth of the median with the growth of the
+                // widget count on a log scale.
+                if (previousCount > 0 && previousMedian > 0.0)
+                {
+                    const double exponent = std::log(median / previousMedian)
+                                            / std::log(static_cast<double>(widgetCount) / previousCount);
+
+                    std::printf("\tscaling %.2f", exponent);
+
+                    if (exponent > SUPERLINEAR_EXPONENT)
+                    {
+                        std::printf("\tSUPERLINEAR");
+                        superlinear = true;
+                    }
+                }
+
+                std::printf("\n");
+                std::fflush(stdout);
+
+                previousCount = widgetCount;
+                previousMedian = median;
+            }
+        }
+    }
+    catch (const gcn::Exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.getMessage().c_str());
+        return 1;
+    }
+
+    return superlinear ? 2 : 0;
+}
@@ -1,11 +1,20 @@
 #ifndef GCN_SFML_HPP
 #define GCN_SFML_HPP
 
+#include <guichan/sfml/sfmlassetpack.hpp>
+#include <guichan/sfml/sfmlcommandlist.hpp>
+#include <guichan/sfml/sfmldiskcache.hpp>
 #include <guichan/sfml/sfmlfont.hpp>
+#include <guichan/sfml/sfmlfontregistry.hpp>
 #include <guichan/sfml/sfmlgraphics.hpp>
 #include <guichan/sfml/sfmlimage.hpp>
 #include <guichan/sfml/sfmlimageloader.hpp>
 #include <guichan/sfml/sfmlinput.hpp>
+#include <guichan/sfml/sfmlmappedfile.hpp>
+#include <guichan/sfml/sfmlpackimageloader.hpp>
+#include <guichan/sfml/sfmlrenderthread.hpp>
+#include <guichan/sfml/sfmltextureatlas.hpp>
+#include <guichan/sfml/sfmltrace.hpp>
 
 #include "platform.hpp"
 
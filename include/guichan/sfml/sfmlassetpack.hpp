@@ -0,0 +1,156 @@
+#ifndef GCN_SFMLASSETPACK_HPP
+#define GCN_SFMLASSETPACK_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "guichan/platform.hpp"
+#include "guichan/sfml/sfmlmappedfile.hpp"
+
+#include <SFML/Config.hpp>
+
+namespace sf
+{
+    class Image;
+}
+
+namespace gcn
+{
+    /**
+     * A read only pack of pre-decoded images, mapped into memory. Packs are
+     * made offline with the gcnpack tool.
+     *
+     * All numbers are stored little endian. The file starts with a header
+     * of four 32-bit values: MAGIC, VERSION, the number of entries and a
+     * reserved zero. Then follows the index, one ENTRY_SIZE record per
+     * image sorted by name, each holding the file offset and length of the
+     * name (32-bit), the file offset (64-bit) and stored size (32-bit) of
+     * the payload, the width, the height and the compression (32-bit
+     * each). Names and payloads follow the index. A payload is the RGBA
+     * pixels of the image, optionally compressed with LZ4.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLAssetPack
+    {
+    public:
+        /**
+         * The ways a payload may be stored.
+         */
+        enum Compression
+        {
+            None = 0,
+            LZ4 = 1
+        };
+
+        /**
+         * An image in the pack.
+         */
+        struct Entry
+        {
+            const char* name; // Not null terminated
+            std::size_t nameLength;
+            const sf::Uint8* data;
+            std::size_t dataSize;
+            unsigned int width;
+            unsigned int height;
+            Compression compression;
+        };
+
+        static const sf::Uint32 MAGIC = 0x4b504347; // "GCPK"
+        static const sf::Uint32 VERSION = 1;
+        static const std::size_t HEADER_SIZE = 16;
+        static const std::size_t ENTRY_SIZE = 32;
+
+        /**
+         * Constructor. Creates a pack with no file.
+         */
+        SFMLAssetPack();
+
+        /**
+         * Constructor. Opens a pack.
+         *
+         * @param filename the pack file.
+         * @throws Exception if the file can't be mapped or isn't a valid pack.
+         */
+        explicit SFMLAssetPack(const std::string& filename);
+
+        /**
+         * Opens a pack, closing the previous one.
+         *
+         * @param filename the pack file.
+         * @return true if the pack was opened.
+         */
+        bool open(const std::string& filename);
+
+        /**
+         * Closes the pack.
+         */
+        void close();
+
+        /**
+         * Checks if a pack is open.
+         *
+         * @return true if a pack is open.
+         */
+        bool isOpen() const;
+
+        /**
+         * Looks an image up by name with a binary search of the index.
+         *
+         * @param name the name of the image, normalized the way
+         *             SFMLImageLoader::normalizePath() does.
+         * @return the entry, or NULL if the pack has no such image.
+         */
+        const Entry* find(const std::string& name) const;
+
+        /**
+         * Gets the number of images in the pack.
+         *
+         * @return the number of images.
+         */
+        std::size_t getEntryCount() const;
+
+        /**
+         * Gets an image of the pack, in name order.
+         *
+         * @param index the index of the image.
+         * @return the entry.
+         */
+        const Entry& getEntry(std::size_t index) const;
+
+        /**
+         * Decodes an image of the pack.
+         *
+         * @param entry the entry of the image.
+         * @param image receives the pixels.
+         * @return true if the image was decoded. Fails for LZ4 payloads if
+         *         the library is built without GCN_SFML_WITH_LZ4.
+         */
+        bool decode(const Entry& entry, sf::Image& image) const;
+
+        /**
+         * Reads a little endian 32-bit value.
+         */
+        static sf::Uint32 readUint32(const sf::Uint8* data);
+
+        /**
+         * Writes a little endian 32-bit value.
+         */
+        static void writeUint32(sf::Uint8* data, sf::Uint32 value);
+
+    protected:
+        /**
+         * Checks the header and reads the index.
+         */
+        bool readIndex();
+
+        SFMLMappedFile mFile;
+        std::vector<Entry> mEntries;
+
+    private:
+        SFMLAssetPack(const SFMLAssetPack&);
+        SFMLAssetPack& operator=(const SFMLAssetPack&);
+    };
+}
+
+#endif // end GCN_SFMLASSETPACK_HPP
@@ -0,0 +1,242 @@
+#ifndef GCN_SFMLCOMMANDLIST_HPP
+#define GCN_SFMLCOMMANDLIST_HPP
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "guichan/color.hpp"
+#include "guichan/platform.hpp"
+#include "guichan/rectangle.hpp"
+
+#include <SFML/Config.hpp>
+#include <SFML/Graphics/BlendMode.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <SFML/System/Vector2.hpp>
+
+namespace sf
+{
+    class Texture;
+}
+
+namespace gcn
+{
+    class Font;
+    class Image;
+    class SFMLFont;
+    class SFMLImage;
+
+    /**
+     * The draw calls of a frame in a compact form, as recorded by
+     * SFMLGraphics with command recording enabled. Lists can be compared by
+     * hash, drawn again with SFMLGraphics::drawCommandList() and saved to a
+     * file, for example to attach a frame to a bug report or to replay it
+     * in a benchmark.
+     *
+     * A recorded list refers to the images, fonts and textures it was
+     * recorded with, which must outlive it. A list loaded from a file owns
+     * its resources instead: images and textures are saved with their
+     * pixels, fonts by their file and character size. Text in fonts which
+     * can't be saved, such as fonts loaded from memory, is left out when
+     * the list is loaded.
+     *
+     * All numbers in the file are stored little endian. The file starts
+     * with MAGIC, VERSION and the number of commands, strings, vertices,
+     * blend modes, textures, images and fonts, all 32-bit. The sections
+     * follow in that order.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLCommandList
+    {
+    public:
+        /**
+         * The kinds of commands.
+         */
+        enum Type
+        {
+            PushClipArea,
+            PopClipArea,
+            FillRectangle,
+            DrawRectangle,
+            DrawLine,
+            DrawPoint,
+            DrawImage,
+            DrawText,
+            DrawTexturedQuads,
+            SetBlendMode
+        };
+
+        /**
+         * A recorded call. Which fields are used depends on the type.
+         * Positions are relative to the clip area, as passed to the call.
+         */
+        struct Command
+        {
+            sf::Uint32 type;
+            sf::Int32 x; // The area, the rectangle, the first point of a line, the destination of an image
+            sf::Int32 y;
+            sf::Int32 width; // For lines the second point
+            sf::Int32 height;
+            sf::Int32 srcX; // The source position of an image
+            sf::Int32 srcY;
+            sf::Uint32 color; // RGBA of the graphics color, or of the font for text
+            sf::Uint32 resource; // The image, font, texture or blend mode
+            sf::Uint32 first; // The string of text, the first vertex of textured quads
+            sf::Uint32 count; // The number of vertices of textured quads
+        };
+
+        static const sf::Uint32 MAGIC = 0x4c434347; // "GCCL"
+        static const sf::Uint32 VERSION = 1;
+        static const std::size_t COMMAND_SIZE = 44;
+
+        /**
+         * Constructor. Creates an empty list.
+         */
+        SFMLCommandList();
+
+        /**
+         * Destructor. Frees the resources of a loaded list.
+         */
+        ~SFMLCommandList();
+
+        /**
+         * Removes all commands, and frees the resources of a loaded list.
+         */
+        void clear();
+
+        void pushClipArea(const Rectangle& area);
+
+        void popClipArea();
+
+        void fillRectangle(const Rectangle& rectangle, const Color& color);
+
+        void drawRectangle(const Rectangle& rectangle, const Color& color);
+
+        void drawLine(int x1, int y1, int x2, int y2, const Color& color);
+
+        void drawPoint(int x, int y, const Color& color);
+
+        void drawImage(const Image* image, int srcX, int srcY, int dstX, int dstY, int width, int height);
+
+        /**
+         * Adds a string, already aligned. The color of an SFMLFont is
+         * recorded with it.
+         */
+        void drawText(Font* font, const std::string& text, int x, int y);
+
+        /**
+         * Adds textured quads, as passed to SFMLGraphics::drawTexturedQuads().
+         * The vertices are copied with the offset applied.
+         */
+        void drawTexturedQuads(const sf::Vertex* vertices,
+                               std::size_t vertexCount,
+                               const sf::Texture* texture,
+                               const sf::Vector2f& offset);
+
+        void setBlendMode(const sf::BlendMode& blendMode);
+
+        /**
+         * Gets the hash of the commands and the resources they refer to.
+         * Lists recorded from the same draw calls with the same resources
+         * have the same hash.
+         *
+         * @return the hash.
+         */
+        sf::Uint64 getHash() const;
+
+        /**
+         * Checks if another list holds the same commands, by comparing the
+         * hashes and sizes of both.
+         *
+         * @param other the list to compare with.
+         * @return true if both lists draw the same.
+         */
+        bool hasSameCommands(const SFMLCommandList& other) const;
+
+        /**
+         * Gets the area in which the list draws differently than another
+         * list, in target space. The draw commands of both lists are
+         * matched from the start and from the end, taking the clip area and
+         * blend mode they are drawn with into account; the area covers
+         * what both lists draw in between.
+         *
+         * @param previous the list to compare with, usually the frame before.
+         * @param root the root clip area both lists were recorded in.
+         * @param area receives the changed area, empty if both lists draw
+         *             the same.
+         * @return false if the lists can't be aligned, because a list pops
+         *         more clip areas than it pushes.
+         */
+        bool getChangedArea(const SFMLCommandList& previous, const Rectangle& root, Rectangle& area) const;
+
+        const std::vector<Command>& getCommands() const;
+
+        const std::vector<sf::Vertex>& getVertices() const;
+
+        const std::string& getString(sf::Uint32 index) const;
+
+        const Image* getImage(sf::Uint32 index) const;
+
+        /**
+         * @return the font, or NULL if it couldn't be loaded.
+         */
+        Font* getFont(sf::Uint32 index) const;
+
+        const sf::Texture* getTexture(sf::Uint32 index) const;
+
+        const sf::BlendMode& getBlendMode(sf::Uint32 index) const;
+
+        /**
+         * Saves the list with its resources.
+         *
+         * @param filename the file to write.
+         * @return true if the file was written.
+         */
+        bool saveToFile(const std::string& filename) const;
+
+        /**
+         * Loads a list saved with saveToFile(), replacing the commands.
+         *
+         * @param filename the file to read.
+         * @return true if the file was read.
+         */
+        bool loadFromFile(const std::string& filename);
+
+    protected:
+        /**
+         * Adds a command and updates the hash.
+         */
+        void add(const Command& command);
+
+        /**
+         * Gets the index of a resource, adding it if it is new.
+         */
+        template <typename T>
+        sf::Uint32 getIndex(std::vector<T*>& resources,
+                            std::map<const void*, sf::Uint32>& indices,
+                            T* resource);
+
+        std::vector<Command> mCommands;
+        std::vector<std::string> mStrings;
+        std::vector<sf::Vertex> mVertices;
+        std::vector<sf::BlendMode> mBlendModes;
+        std::vector<const sf::Texture*> mTextures;
+        std::vector<const Image*> mImages;
+        std::vector<Font*> mFonts;
+        std::map<const void*, sf::Uint32> mTextureIndices;
+        std::map<const void*, sf::Uint32> mImageIndices;
+        std::map<const void*, sf::Uint32> mFontIndices;
+        sf::Uint64 mHash;
+
+        // Resources of a loaded list
+        std::vector<sf::Texture*> mOwnedTextures;
+        std::vector<SFMLImage*> mOwnedImages;
+        std::vector<SFMLFont*> mOwnedFonts;
+
+    private:
+        SFMLCommandList(const SFMLCommandList&);
+        SFMLCommandList& operator=(const SFMLCommandList&);
+    };
+}
+
+#endif // end GCN_SFMLCOMMANDLIST_HPP
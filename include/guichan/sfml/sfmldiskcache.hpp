@@ -0,0 +1,126 @@
+#ifndef GCN_SFMLDISKCACHE_HPP
+#define GCN_SFMLDISKCACHE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "guichan/platform.hpp"
+
+#include <SFML/Config.hpp>
+#include <SFML/System/Mutex.hpp>
+
+namespace sf
+{
+    class Image;
+}
+
+namespace gcn
+{
+    /**
+     * A directory of decoded images which outlives the process, so image
+     * files don't have to be decoded again on the next start. Entries are
+     * keyed by a hash of the path, size and modification time of the
+     * source file, so changed files are decoded again. Each entry holds a
+     * checksum of its pixels; damaged entries are ignored. When the
+     * directory grows beyond its size limit, the least recently used
+     * entries are deleted.
+     *
+     * All methods may be called from several threads at once.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLDiskCache
+    {
+    public:
+        static const sf::Uint32 MAGIC = 0x43494347; // "GCIC"
+        static const sf::Uint32 VERSION = 1;
+        static const std::size_t HEADER_SIZE = 32;
+
+        /**
+         * Constructor. Creates the directory if needed and prunes it to
+         * the size limit.
+         *
+         * @param directory the directory to keep the decoded images in.
+         * @param maxBytes the size limit of the directory.
+         */
+        SFMLDiskCache(const std::string& directory, std::size_t maxBytes);
+
+        /**
+         * Loads the decoded pixels of an image file.
+         *
+         * @param filename the image file.
+         * @param image receives the pixels.
+         * @return true if the cache held valid pixels for the file as it is
+         *         now.
+         */
+        bool load(const std::string& filename, sf::Image& image);
+
+        /**
+         * Stores the decoded pixels of an image file.
+         *
+         * @param filename the image file.
+         * @param image the pixels of the file.
+         */
+        void store(const std::string& filename, const sf::Image& image);
+
+        /**
+         * Deletes the least recently used entries until the directory is
+         * within its size limit.
+         */
+        void prune();
+
+        /**
+         * Gets the directory the decoded images are kept in.
+         *
+         * @return the directory.
+         */
+        const std::string& getDirectory() const;
+
+        /**
+         * Gets the number of images loaded from the cache.
+         *
+         * @return the number of cache hits.
+         */
+        unsigned int getHits() const;
+
+        /**
+         * Gets the number of images which weren't in the cache or whose
+         * entry was out of date or damaged.
+         *
+         * @return the number of cache misses.
+         */
+        unsigned int getMisses() const;
+
+        /**
+         * Computes a 64-bit FNV-1a hash.
+         *
+         * @param data the data to hash.
+         * @param size the size of the data in bytes.
+         * @param hash the hash to continue from.
+         * @return the hash.
+         */
+        static sf::Uint64 hash(const void* data, std::size_t size, sf::Uint64 hash = 14695981039346656037ULL);
+
+    protected:
+        /**
+         * Computes the key of an image file from its path, size and
+         * modification time.
+         *
+         * @return false if the file doesn't exist.
+         */
+        bool getKey(const std::string& filename, sf::Uint64& key) const;
+
+        /**
+         * Gets the path of the entry for a key.
+         */
+        std::string getEntryPath(sf::Uint64 key) const;
+
+        std::string mDirectory;
+        std::size_t mMaxBytes;
+        std::size_t mTotalBytes; // Size of the directory as of the last prune plus stores since
+        unsigned int mHits;
+        unsigned int mMisses;
+        unsigned int mTemporaryCount; // Makes names of files being written unique
+        mutable sf::Mutex mMutex;
+    };
+}
+
+#endif // end GCN_SFMLDISKCACHE_HPP
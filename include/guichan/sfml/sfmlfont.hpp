@@ -1,12 +1,23 @@
 #ifndef GCN_SFMLFONT_HPP
 #define GCN_SFMLFONT_HPP
 
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "guichan/font.hpp"
 #include "guichan/platform.hpp"
+#include "guichan/sfml/sfmlfontregistry.hpp"
 
+#include <SFML/Config.hpp>
 #include <SFML/Graphics/Color.hpp>
 #include <SFML/Graphics/Font.hpp>
 #include <SFML/Graphics/Text.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <SFML/System/Time.hpp>
 
 namespace gcn
 {
@@ -17,14 +28,34 @@ namespace gcn
     {
     public:
         /**
-         * Constructor.
+         * Constructor. The font face is shared through the default
+         * SFMLFontRegistry.
          */
         SFMLFont(const std::string& filename, unsigned int size);
 
+        /**
+         * Constructor. The font face is shared through the given registry,
+         * which must outlive the font.
+         */
+        SFMLFont(SFMLFontRegistry& registry, const std::string& filename, unsigned int size);
+
+        /**
+         * Constructor. Loads the font from a font file already in memory,
+         * such as an SFMLMappedFile. The memory is used as is, not copied,
+         * and must stay valid as long as the font exists. Fonts using the
+         * same memory share their face through the default
+         * SFMLFontRegistry.
+         *
+         * @param data the contents of the font file.
+         * @param dataSize the size of the font file in bytes.
+         * @param size the character size.
+         */
+        SFMLFont(const void* data, std::size_t dataSize, unsigned int size);
+
         /**
          * Destructor.
          */
-        virtual ~SFMLFont(){}
+        virtual ~SFMLFont();
 
         const sf::Color& getColor() const;
 
@@ -32,6 +63,86 @@ namespace gcn
 
         const sf::Font& getFont() const;
 
+        /**
+         * Gets the file the font was loaded from.
+         *
+         * @return the file, or an empty string for fonts loaded from memory.
+         */
+        const std::string& getFilename() const;
+
+        /**
+         * Sets how many measured strings getWidth() remembers. The least
+         * recently used string is forgotten first. Zero disables the cache.
+         *
+         * @param size the maximum number of remembered strings.
+         */
+        void setWidthCacheSize(std::size_t size);
+
+        /**
+         * Gets the number of getWidth() calls answered from the cache.
+         *
+         * @return the number of cache hits.
+         */
+        unsigned int getWidthCacheHits() const;
+
+        /**
+         * Gets the number of getWidth() calls which had to measure the string.
+         *
+         * @return the number of cache misses.
+         */
+        unsigned int getWidthCacheMisses() const;
+
+        /**
+         * Gets the total time spent measuring strings which weren't cached.
+         *
+         * @return the time spent measuring.
+         */
+        sf::Time getMeasureTime() const;
+
+        /**
+         * Sets how many laid out strings drawString() remembers. The glyph
+         * quads of a remembered string are reused as long as the string,
+         * character size, style and color stay the same. The least recently
+         * drawn string is forgotten first. Zero disables the cache.
+         *
+         * @param size the maximum number of remembered strings.
+         */
+        void setGeometryCacheSize(std::size_t size);
+
+        /**
+         * Gets the number of drawString() calls which reused cached glyph
+         * quads.
+         *
+         * @return the number of cache hits.
+         */
+        unsigned int getGeometryCacheHits() const;
+
+        /**
+         * Gets the number of drawString() calls which had to lay out the
+         * string.
+         *
+         * @return the number of cache misses.
+         */
+        unsigned int getGeometryCacheMisses() const;
+
+        /**
+         * Draws a string in the given color instead of the color of the
+         * font, without changing the color of the font.
+         */
+        void drawString(Graphics* graphics, const std::string& text, int x, int y, const sf::Color& color);
+
+        /**
+         * Gets the area covered by the glyphs of a string drawn at the
+         * origin, which may reach beyond getWidth() and getHeight(), for
+         * example with descenders.
+         *
+         * @param text the string.
+         * @param color the color the string is drawn in, to share the laid
+         *              out glyphs with drawString().
+         * @return the area covered by the glyphs.
+         */
+        sf::FloatRect getStringBounds(const std::string& text, const sf::Color& color);
+
         // Inherited from Font
 
         virtual void drawString(Graphics* graphics, const std::string& text, int x, int y);
@@ -43,9 +154,102 @@ namespace gcn
         virtual int getStringIndexAt(const std::string& text, int x) const;
 
     protected:
+        typedef SFMLFontRegistry::AdvanceTable AdvanceTable;
+
+        /**
+         * Sets up the text settings once the face has been acquired.
+         */
+        void init(unsigned int size);
+
+        /**
+         * Gets the advance table for the current character size, building
+         * it on first use.
+         */
+        AdvanceTable& getAdvanceTable() const;
+
+        /**
+         * Gets the kerning between two characters, looking it up in the
+         * font on first use.
+         */
+        float getKerning(AdvanceTable& table, unsigned char first, unsigned char second) const;
+
+        /**
+         * Measures a string using the advance table.
+         */
+        float measure(const std::string& text) const;
+
+        /**
+         * Gets the caret positions of a string: element i is the x
+         * coordinate after the first i characters. The positions never
+         * decrease, so they can be searched with a binary search. The array
+         * for the last string asked for is kept and reused.
+         */
+        const std::vector<float>& getPrefixAdvances(const std::string& text) const;
+
+        /**
+         * Identifies a laid out string.
+         */
+        struct TextGeometryKey
+        {
+            std::string text;
+            unsigned int characterSize;
+            sf::Uint32 style;
+            sf::Uint32 color;
+
+            bool operator<(const TextGeometryKey& other) const;
+        };
+
+        /**
+         * Glyph quads of a string laid out at the origin, the way sf::Text
+         * lays it out.
+         */
+        struct TextGeometry
+        {
+            std::vector<sf::Vertex> vertices;
+            sf::FloatRect bounds;
+        };
+
+        /**
+         * Gets the glyph quads of a string in the current character size
+         * and style and the given color, laying it out if it isn't cached.
+         */
+        const TextGeometry& getTextGeometry(const std::string& text, const sf::Color& color);
+
+        /**
+         * Lays out a string into glyph quads.
+         */
+        void buildTextGeometry(const std::string& text, const sf::Color& color, TextGeometry& geometry) const;
+
+        typedef std::list<std::pair<std::string, int> > WidthList;
+        typedef std::list<std::pair<TextGeometryKey, TextGeometry> > GeometryList;
+
+        mutable WidthList mWidthList; // Most recently used first
+        mutable std::map<std::string, WidthList::iterator> mWidthCache;
+        std::size_t mWidthCacheSize;
+        mutable unsigned int mWidthCacheHits;
+        mutable unsigned int mWidthCacheMisses;
+        mutable sf::Time mMeasureTime;
+
+        mutable std::string mPrefixText; // String the prefix advances belong to
+        mutable unsigned int mPrefixCharacterSize;
+        mutable std::vector<float> mPrefixAdvances;
+
+        GeometryList mGeometryList; // Most recently used first
+        std::map<TextGeometryKey, GeometryList::iterator> mGeometryCache;
+        std::size_t mGeometryCacheSize;
+        unsigned int mGeometryCacheHits;
+        unsigned int mGeometryCacheMisses;
+        TextGeometry mUncachedGeometry; // Used when the cache is disabled
+
+        SFMLFontRegistry* mRegistry;
+        SFMLFontRegistry::Face* mFace; // Shared with other fonts of the same file
+        std::string mFilename; // Empty if loaded from memory
         sf::Color mColor;
-        sf::Font mFont;
         sf::Text mText;
+
+    private:
+        SFMLFont(const SFMLFont&);
+        SFMLFont& operator=(const SFMLFont&);
     };
 }
 
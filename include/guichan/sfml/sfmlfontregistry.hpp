@@ -0,0 +1,166 @@
+#ifndef GCN_SFMLFONTREGISTRY_HPP
+#define GCN_SFMLFONTREGISTRY_HPP
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "guichan/platform.hpp"
+#include "guichan/sfml/sfmlmappedfile.hpp"
+
+#include <SFML/Config.hpp>
+#include <SFML/Graphics/Font.hpp>
+#include <SFML/System/Mutex.hpp>
+
+namespace gcn
+{
+    /**
+     * Loads every font face once and shares it between all SFMLFonts using
+     * the same file, whatever their size or color. Sharing the sf::Font
+     * also shares its glyph pages and the glyph metrics SFMLFont measures
+     * strings with. A face is unloaded when the last font using it is
+     * destroyed.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLFontRegistry
+    {
+    public:
+        /**
+         * Horizontal metrics of the 256 byte values of a std::string at one
+         * character size, laid out the way sf::Text lays them out.
+         */
+        struct AdvanceTable
+        {
+            float advances[256];
+            sf::Uint32 codePoints[256];
+            std::vector<float> kerning; // 256 * 256 pairs, filled on demand
+            std::vector<bool> kerningKnown;
+        };
+
+        /**
+         * A loaded font face.
+         */
+        struct Face
+        {
+            SFMLMappedFile mapping; // Font file, if mapped. Must outlive the font
+            sf::Font font;
+            std::string filename;
+            std::size_t fileBytes;
+            bool mapped;
+            unsigned int references;
+            std::map<unsigned int, unsigned int> characterSizes; // Size -> fonts using it
+            std::map<unsigned int, AdvanceTable> advanceTables;
+            sf::Mutex mutex; // Held by its fonts while measuring and drawing, which may happen on two threads
+        };
+
+        /**
+         * Memory used by a face.
+         */
+        struct FaceInfo
+        {
+            std::string filename;
+            unsigned int references;
+            std::size_t fileBytes; // Size of the font file
+            bool mapped; // True if the file is shared through the page cache
+            std::size_t glyphPageBytes; // Glyph pages of the sizes in use
+            std::size_t metricsBytes; // Advance and kerning tables
+        };
+
+        /**
+         * Constructor.
+         */
+        SFMLFontRegistry();
+
+        /**
+         * Destructor. Unloads the faces still in use.
+         */
+        ~SFMLFontRegistry();
+
+        /**
+         * Gets the registry used by SFMLFonts which aren't given one.
+         *
+         * @return the default registry.
+         */
+        static SFMLFontRegistry& getDefault();
+
+        /**
+         * Gets a face, loading it if no font uses it yet.
+         *
+         * @param filename the font file.
+         * @param characterSize the character size the face will be used at.
+         * @return the face.
+         * @throws Exception if the file can't be loaded.
+         */
+        Face* acquire(const std::string& filename, unsigned int characterSize);
+
+        /**
+         * Gets a face for a font file already in memory, loading it if no
+         * font uses it yet. Faces are told apart by the address and size
+         * of the memory, which must stay valid as long as the face is used.
+         *
+         * @param data the contents of the font file.
+         * @param size the size of the font file in bytes.
+         * @param characterSize the character size the face will be used at.
+         * @return the face.
+         * @throws Exception if the font can't be loaded.
+         */
+        Face* acquire(const void* data, std::size_t size, unsigned int characterSize);
+
+        /**
+         * Sets whether font files are memory mapped with SFMLMappedFile
+         * instead of being read by FreeType. Mapped files are shared with
+         * other processes using the same font through the page cache.
+         * Only affects faces loaded afterwards.
+         *
+         * @param memoryMappingEnabled true to map font files.
+         */
+        void setMemoryMappingEnabled(bool memoryMappingEnabled);
+
+        /**
+         * Checks if font files are memory mapped.
+         *
+         * @return true if font files are memory mapped.
+         */
+        bool isMemoryMappingEnabled() const;
+
+        /**
+         * Gives up a face acquired with acquire(), unloading it if no
+         * other font uses it.
+         *
+         * @param face the face.
+         * @param characterSize the character size it was acquired for.
+         */
+        void release(Face* face, unsigned int characterSize);
+
+        /**
+         * Gets the number of loaded faces.
+         *
+         * @return the number of loaded faces.
+         */
+        std::size_t getFaceCount() const;
+
+        /**
+         * Gets the memory used by each loaded face.
+         *
+         * @return one entry per face.
+         */
+        std::vector<FaceInfo> getFaceInfo() const;
+
+    protected:
+        typedef std::map<std::string, Face*> FaceMap;
+
+        /**
+         * Adds a reference to a face.
+         */
+        Face* reference(Face* face, unsigned int characterSize);
+
+        FaceMap mFaces;
+        bool mMemoryMappingEnabled;
+
+    private:
+        SFMLFontRegistry(const SFMLFontRegistry&);
+        SFMLFontRegistry& operator=(const SFMLFontRegistry&);
+    };
+}
+
+#endif // end GCN_SFMLFONTREGISTRY_HPP
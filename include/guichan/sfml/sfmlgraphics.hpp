@@ -4,20 +4,35 @@
 #include "guichan/color.hpp"
 #include "guichan/graphics.hpp"
 #include "guichan/platform.hpp"
-
-#include <SFML/Graphics/Sprite.hpp>
+#include "guichan/rectangle.hpp"
+#include "guichan/sfml/sfmlcommandlist.hpp"
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics/BlendMode.hpp>
+#include <SFML/Graphics/Color.hpp>
+#include <SFML/Graphics/Rect.hpp>
+#include <SFML/Graphics/Vertex.hpp>
 #include <SFML/Graphics/View.hpp>
 #include <SFML/System/Vector2.hpp>
 
 namespace sf
 {
+    class Drawable;
     class RenderTarget;
+    class RenderTexture;
+    class Texture;
 }
 
 namespace gcn
 {
+    class Font;
     class Image;
-    class Rectangle;
 
     /**
      * SFML implementation of the Graphics.
@@ -29,16 +44,52 @@ namespace gcn
         // Needed so that drawImage(gcn::Image *, int, int) is visible.
         using Graphics::drawImage;
 
+        /**
+         * Statistics of the cached layers.
+         */
+        struct CachedLayerStatistics
+        {
+            unsigned int hits; // Layers drawn from their texture
+            unsigned int misses; // Layers which had to be rendered
+            unsigned int evictions; // Layers dropped to stay within the budget
+            std::size_t layerCount; // Layers currently kept
+            std::size_t textureBytes; // Memory of the textures currently kept
+        };
+
+        /**
+         * Counters of what the backend did in a frame. They are only
+         * gathered when the library is built with GCN_SFML_ENABLE_STATISTICS
+         * and stay zero otherwise.
+         */
+        struct FrameStatistics
+        {
+            unsigned int drawCalls; // Draws submitted to the render target
+            unsigned int vertices; // Vertices submitted with those draws
+            unsigned int textureBinds; // Changes of the texture between draws
+            unsigned int viewChanges; // Views set for clip areas, layers and the backbuffer
+            unsigned int rejectedPrimitives; // Primitives dropped for being outside the clip area
+            unsigned int textDraws; // Calls to drawText()
+            float cpuTime; // Milliseconds spent in the backend
+        };
+
         /**
          * Constructor.
          */
         SFMLGraphics(sf::RenderTarget& target);
 
+        /**
+         * Destructor.
+         */
+        virtual ~SFMLGraphics();
+
         /**
          * Sets the RenderTarget to draw to. The target can be any RenderTarget.
          * This funtion also pushes a clip areas corresponding to the dimension 
          * of the target.
          *
+         * With damage tracking the target can't be changed between
+         * _beginDraw() and _endDraw(), and changing it damages everything.
+         *
          * @param target the target to draw to.
          */
         virtual void setRenderTarget(sf::RenderTarget& target);
@@ -50,6 +101,322 @@ namespace gcn
          */
         virtual sf::RenderTarget& getRenderTarget() const;
 
+        /**
+         * Submits all batched geometry to the RenderTarget in a single draw
+         * call. The batch is flushed automatically whenever the texture, the
+         * clip area or the blend mode changes and at the end of drawing, so
+         * this only needs to be called before drawing to the RenderTarget
+         * directly.
+         */
+        virtual void flush();
+
+        /**
+         * Sets the blend mode used for subsequent drawing. Changing the blend
+         * mode flushes the batch.
+         *
+         * @param blendMode the blend mode to use.
+         */
+        virtual void setBlendMode(const sf::BlendMode& blendMode);
+
+        /**
+         * Gets the blend mode used for drawing.
+         *
+         * @return the blend mode used for drawing.
+         */
+        virtual const sf::BlendMode& getBlendMode() const;
+
+        /**
+         * Sets the color of the rectangle drawn in place of images which are
+         * still being loaded by SFMLImageLoader::loadAsync(). The default is
+         * a translucent gray; a fully transparent color draws nothing.
+         *
+         * @param color the color of the placeholder.
+         */
+        void setPendingImageColor(const Color& color);
+
+        /**
+         * Gets the color of the rectangle drawn in place of pending images.
+         *
+         * @return the color of the placeholder.
+         */
+        const Color& getPendingImageColor() const;
+
+        /**
+         * Gets the number of times the batch has been flushed to the
+         * RenderTarget since the last call to _beginDraw(). After _endDraw()
+         * this is the number of draw calls the frame took.
+         *
+         * @return the number of flushes in the current frame.
+         */
+        unsigned int getFlushCount() const;
+
+        /**
+         * Gets the statistics of the last frame, that is from the last
+         * _beginDraw() to the following _endDraw().
+         *
+         * @return the statistics of the last frame.
+         * @see FrameStatistics
+         */
+        const FrameStatistics& getFrameStatistics() const;
+
+        /**
+         * Gets the statistics averaged over the last frames.
+         *
+         * @return the average statistics, counters rounded to the nearest integer.
+         * @see setStatisticsWindow
+         */
+        FrameStatistics getAverageFrameStatistics() const;
+
+        /**
+         * Sets how many frames getAverageFrameStatistics() averages over.
+         * The default is 60. Changing it drops the frames kept so far.
+         *
+         * @param frames the number of frames, at least 1.
+         */
+        void setStatisticsWindow(unsigned int frames);
+
+        /**
+         * Gets how many frames getAverageFrameStatistics() averages over.
+         *
+         * @return the number of frames.
+         */
+        unsigned int getStatisticsWindow() const;
+
+        /**
+         * Sets whether clipping is done on the CPU. By default every clip
+         * area is emulated with its own sf::View, which means every
+         * pushClipArea() and popClipArea() flushes the batch. With software
+         * clipping the view is set once per frame and all geometry is
+         * intersected with the current clip area before it is batched.
+         * The mode can only be changed outside of _beginDraw() and
+         * _endDraw().
+         *
+         * @param softwareClipping true to clip on the CPU.
+         */
+        void setSoftwareClipping(bool softwareClipping);
+
+        /**
+         * Checks if clipping is done on the CPU.
+         *
+         * @return true if clipping is done on the CPU.
+         * @see setSoftwareClipping
+         */
+        bool isSoftwareClipping() const;
+
+        /**
+         * Draws an SFML drawable which can't be batched, such as an sf::Text,
+         * clipped to the current clip area. The batch is flushed first so
+         * drawing order is preserved. Nothing is drawn if the bounds lie
+         * outside of the clip area.
+         *
+         * @param drawable the drawable to draw, positioned in target space.
+         * @param bounds the bounds of the drawable in target space.
+         */
+        virtual void drawUnbatched(const sf::Drawable& drawable, const sf::FloatRect& bounds);
+
+        /**
+         * Adds axis aligned textured quads, such as the glyphs of a string,
+         * to the batch. Each quad is four vertices in the order top left,
+         * top right, bottom right, bottom left. Quads are trimmed to the
+         * current clip area, adjusting their texture coordinates to match.
+         *
+         * @param vertices the vertices of the quads.
+         * @param vertexCount the number of vertices, four per quad.
+         * @param texture the texture of the quads.
+         * @param offset added to every vertex position, in target space.
+         */
+        virtual void drawTexturedQuads(const sf::Vertex* vertices,
+                                       std::size_t vertexCount,
+                                       const sf::Texture* texture,
+                                       const sf::Vector2f& offset);
+
+        /**
+         * Sets whether only damaged areas are redrawn. With damage tracking
+         * the GUI is drawn into a persistent backbuffer instead of the
+         * RenderTarget. _beginDraw() limits the outermost clip area to the
+         * area damaged since the last frame, so everything outside of it is
+         * rejected, and _endDraw() draws the backbuffer onto the
+         * RenderTarget. A frame in which nothing was damaged costs a single
+         * textured quad. The backbuffer has premultiplied alpha and is
+         * drawn with a matching blend mode. The mode can only be changed
+         * outside of _beginDraw() and _endDraw().
+         *
+         * @param damageTracking true to redraw damaged areas only.
+         */
+        void setDamageTracking(bool damageTracking);
+
+        /**
+         * Checks if only damaged areas are redrawn.
+         *
+         * @return true if only damaged areas are redrawn.
+         * @see setDamageTracking
+         */
+        bool isDamageTracking() const;
+
+        /**
+         * Reports an area which has to be redrawn in the next frame, for
+         * instance the dimension of a widget which changed. Damaged areas
+         * are merged into their bounding rectangle.
+         *
+         * @param area the damaged area in target space.
+         */
+        void addDamage(const Rectangle& area);
+
+        /**
+         * Damages the whole target, so the next frame is drawn completely.
+         */
+        void damageAll();
+
+        /**
+         * Checks if anything has been damaged since the last frame.
+         *
+         * @return true if the next frame has anything to redraw.
+         */
+        bool hasDamage() const;
+
+        /**
+         * Draws the backbuffer onto the RenderTarget without drawing the
+         * GUI. With damage tracking, an application which knows nothing
+         * changed can call this instead of Gui::draw(). Does nothing
+         * without damage tracking.
+         */
+        void presentBackbuffer();
+
+        /**
+         * Starts a cached layer: an area whose contents are rendered once
+         * into a texture of their own and then drawn as a single textured
+         * quad until the layer is invalidated. Meant for parts of the GUI
+         * which are costly to draw but rarely change.
+         *
+         * If this returns true the contents have to be drawn, exactly as
+         * after pushClipArea(area), and endCachedLayer() must be called
+         * afterwards. If it returns false the layer has already been drawn
+         * from its texture; the contents must not be drawn and
+         * endCachedLayer() must not be called.
+         *
+         * Layers are composited with premultiplied alpha, so translucent
+         * contents look the same as when drawn directly.
+         *
+         * @param id identifies the layer.
+         * @param area the area of the layer, relative to the current clip area.
+         * @return true if the contents of the layer have to be drawn.
+         */
+        bool beginCachedLayer(const std::string& id, const Rectangle& area);
+
+        /**
+         * Ends a cached layer started with beginCachedLayer() and draws it.
+         */
+        void endCachedLayer();
+
+        /**
+         * Makes a cached layer render its contents again the next time it
+         * is drawn.
+         *
+         * @param id identifies the layer.
+         */
+        void invalidateCachedLayer(const std::string& id);
+
+        /**
+         * Makes every cached layer render its contents again the next time
+         * it is drawn.
+         */
+        void invalidateCachedLayers();
+
+        /**
+         * Sets how much texture memory the cached layers may use. When a
+         * new layer doesn't fit, the least recently drawn layers are
+         * dropped. A layer larger than the budget is drawn directly.
+         *
+         * @param bytes the budget in bytes.
+         */
+        void setCachedLayerBudget(std::size_t bytes);
+
+        /**
+         * Gets how much texture memory the cached layers may use.
+         *
+         * @return the budget in bytes.
+         */
+        std::size_t getCachedLayerBudget() const;
+
+        /**
+         * Gets the statistics of the cached layers.
+         *
+         * @return the statistics.
+         */
+        const CachedLayerStatistics& getCachedLayerStatistics() const;
+
+        /**
+         * Sets whether draw calls are recorded instead of executed. While
+         * recording, the calls of a frame are collected in an
+         * SFMLCommandList and executed in _endDraw(). If the list hashes
+         * the same as the one of the previous frame, the vertices submitted
+         * for that frame are submitted again without going through the
+         * widgets' draw calls. With damage tracking an unchanged frame
+         * without damage presents the backbuffer as is instead, and a
+         * changed frame damages the area where its commands differ from
+         * those of the previous frame, see SFMLCommandList::getChangedArea().
+         * Everything is damaged if there is no previous frame, the view
+         * changed or the lists can't be aligned.
+         *
+         * Cached layers and drawUnbatched() can't be used while recording.
+         * The mode can only be changed outside of _beginDraw() and
+         * _endDraw().
+         *
+         * @param commandRecording true to record draw calls.
+         */
+        void setCommandRecording(bool commandRecording);
+
+        /**
+         * Checks whether draw calls are recorded.
+         *
+         * @return true if draw calls are recorded.
+         * @see setCommandRecording
+         */
+        bool isCommandRecording() const;
+
+        /**
+         * Gets the commands of the last frame recorded. They can be saved
+         * with SFMLCommandList::saveToFile().
+         *
+         * @return the commands of the last frame.
+         */
+        const SFMLCommandList& getLastCommandList() const;
+
+        /**
+         * Gets the number of recorded frames which were replayed because
+         * they were the same as the frame before.
+         *
+         * @return the number of replayed frames.
+         */
+        unsigned int getReplayHits() const;
+
+        /**
+         * Gets the number of recorded frames which had to be executed.
+         *
+         * @return the number of executed frames.
+         */
+        unsigned int getReplayMisses() const;
+
+        /**
+         * Executes the commands of a list, for example one loaded from a
+         * file, inside the current clip area. The color of the graphics is
+         * restored afterwards. Pixel changes of the images drawn are not
+         * uploaded; recording a frame uploads them already.
+         *
+         * @param list the commands to execute.
+         */
+        void drawCommandList(const SFMLCommandList& list);
+
+        /**
+         * Abandons a frame which failed between _beginDraw() and
+         * _endDraw(), for example because a draw call threw. Drops the
+         * batched quads, the clip stack, cached layers still being rendered
+         * and the frame being recorded, and restores the RenderTarget and its
+         * view, so the next frame starts out clean. With damage tracking the
+         * next frame is drawn completely.
+         */
+        void abortFrame();
+
         // Inherited from Graphics
 
         virtual void _beginDraw();
@@ -97,7 +464,67 @@ namespace gcn
          */
         static sf::Color convertGuichanColorToSFMLColor(const Color& color);
 
+        /**
+         * Converts Guichan colors to packed 8-bit RGBA values, clamping each
+         * component to [0, 255]. Uses SSE2 or NEON when available.
+         *
+         * @param colors the colors to convert.
+         * @param rgba receives count * 4 bytes.
+         * @param count the number of colors.
+         */
+        static void convertGuichanColorsToRGBA(const Color* colors, sf::Uint8* rgba, std::size_t count);
+
+        /**
+         * Converts packed 8-bit RGBA values to Guichan colors. Uses SSE2 or
+         * NEON when available.
+         *
+         * @param rgba count * 4 bytes to convert.
+         * @param colors receives the colors.
+         * @param count the number of colors.
+         */
+        static void convertRGBAToGuichanColors(const sf::Uint8* rgba, Color* colors, std::size_t count);
+
     protected:
+        /**
+         * Sets the view of the render target.
+         */
+        void setTargetView(const sf::View& view);
+
+        /**
+         * Stores the statistics of the frame which just ended.
+         */
+        void endFrameStatistics();
+
+        /**
+         * Starts drawing the frame into the render target.
+         */
+        void beginFrame();
+
+        /**
+         * Finishes drawing the frame into the render target.
+         */
+        void endFrame();
+
+        /**
+         * Starts recording the draw calls of a frame.
+         */
+        void beginRecording();
+
+        /**
+         * Finishes recording, then replays or executes the recorded frame.
+         */
+        void endRecording();
+
+        /**
+         * Submits the vertices captured when the previous frame was executed.
+         */
+        void replayFrame();
+
+        /**
+         * Draws text of a command list in the recorded color of the font.
+         */
+        void drawCommandText(Font* font, const std::string& text, int x, int y, sf::Uint32 color);
+
         /**
          * Converts a ClipRectangle to an sf::View to be used for clipping by a RenderTarget.
          */
@@ -112,6 +539,29 @@ namespace gcn
          */
         void _drawFauxPixel(int x, int y);
 
+        /**
+         * Intersects a rectangle in target space with the current clip area.
+         *
+         * @param rectangle the rectangle to intersect, modified in place.
+         * @return false if nothing of the rectangle is left.
+         */
+        bool intersectWithClipArea(Rectangle& rectangle) const;
+
+        /**
+         * Adds a quad to the batch, flushing the batch first if it was
+         * collected with a different texture.
+         *
+         * @param quad the four vertices of the quad.
+         * @param texture the texture of the quad, or NULL if untextured.
+         */
+        void addQuad(const sf::Vertex* quad, const sf::Texture* texture);
+
+        /**
+         * Adds an untextured rectangle in the current color to the batch.
+         * The coordinates are in target space; no clipping is done.
+         */
+        void addRectangle(float x, float y, float width, float height);
+
         /**
          * Draws a horizontal line from (x1, y) to (x2, y).
          * @param x1 the starting x coordinate
@@ -129,7 +579,29 @@ namespace gcn
         void drawVerticalLine(int x, int y1, int y2);
 
         /**
-         * Draws a line from (x1, y1) to (x2, y2) using Bresenham's line algorithm.
+         * Draws a horizontal run of pixels from (x1, y) to (x2, y) as a
+         * single quad, clipped against the current clip area. Coordinates
+         * are in target space and x1 must not be greater than x2.
+         * @param x1 the starting x coordinate
+         * @param x2 the terminating x coordinate
+         * @param y
+         */
+        void drawHorizontalSpan(int x1, int x2, int y);
+
+        /**
+         * Draws a vertical run of pixels from (x, y1) to (x, y2) as a
+         * single quad, clipped against the current clip area. Coordinates
+         * are in target space and y1 must not be greater than y2.
+         * @param x
+         * @param y1 the starting y coordinate
+         * @param y2 the terminating y coordinate
+         */
+        void drawVerticalSpan(int x, int y1, int y2);
+
+        /**
+         * Draws a line from (x1, y1) to (x2, y2) using Bresenham's line
+         * algorithm. Pixels sharing a row (or a column for steep lines) are
+         * emitted as one span, so a line costs one quad per run.
          * @param x1
          * @param y1
          * @param x2
@@ -137,18 +609,126 @@ namespace gcn
          */
         void drawBresenham(int x1, int y1, int x2, int y2);
 
+        /**
+         * Starts a frame which is drawn into the backbuffer, limited to the
+         * damaged area.
+         */
+        void beginBackbufferFrame();
+
+        /**
+         * A layer kept in a texture.
+         */
+        struct CachedLayer
+        {
+            sf::RenderTexture* texture;
+            bool valid; // False if the contents have to be rendered again
+            bool rendering; // True between beginCachedLayer() and endCachedLayer()
+            std::list<std::string>::iterator use; // Position in mCachedLayerUse
+        };
+
+        /**
+         * What beginCachedLayer() replaced while the contents of a layer
+         * are rendered.
+         */
+        struct LayerState
+        {
+            std::string id;
+            bool direct; // True if the layer is drawn without a texture
+            Rectangle area; // The area of the layer in target space
+            sf::RenderTarget* target;
+            sf::View contextView;
+            sf::View clipView;
+            sf::Vector2f size;
+            std::stack<ClipRectangle> clipStack;
+        };
+
+        /**
+         * Draws the texture of a layer over its area, clipped to the
+         * current clip area.
+         */
+        void drawCachedLayer(const sf::Texture& texture, const Rectangle& area);
+
+        /**
+         * Drops the least recently drawn layers until the given number of
+         * bytes fits into the budget.
+         *
+         * @return false if it doesn't fit even with all other layers dropped.
+         */
+        bool makeRoomForCachedLayer(std::size_t bytes);
+
+        /**
+         * Drops a layer and its texture.
+         */
+        void eraseCachedLayer(std::map<std::string, CachedLayer>::iterator layer);
+
         sf::RenderTarget* mTarget;
         sf::View mContextView;
+        sf::View mClipView; // The view set for the current clip area
         sf::Vector2f mSize;
-        sf::Sprite mSprite;
         sf::Color mSfmlColor;
         Color mColor;
 
+        std::vector<sf::Vertex> mBatch; // Quads waiting to be submitted
+        const sf::Texture* mBatchTexture;
+        sf::BlendMode mBlendMode;
+        unsigned int mFlushCount;
+        Color mPendingImageColor;
+        bool mSoftwareClipping;
+
+        bool mDamageTracking;
+        sf::RenderTexture* mBackbuffer;
+        sf::RenderTarget* mPresentTarget; // Target the backbuffer is drawn onto, while drawing into it
+        sf::View mPresentView; // The view of mPresentTarget
+        Rectangle mDamage; // Bounding rectangle of the damage, empty if none
+
+        std::map<std::string, CachedLayer> mCachedLayers;
+        std::list<std::string> mCachedLayerUse; // Most recently drawn first
+        std::vector<LayerState> mLayerStack; // Layers being rendered, innermost last
+        std::size_t mCachedLayerBudget;
+        CachedLayerStatistics mCachedLayerStatistics;
+
+        FrameStatistics mFrameStatistics; // Statistics of the frame being drawn
+        FrameStatistics mLastFrameStatistics;
+        std::vector<FrameStatistics> mStatisticsHistory; // Ring of the last frames
+        std::size_t mStatisticsHistoryNext; // Where the next frame goes in the ring
+        unsigned int mStatisticsWindow;
+        const sf::Texture* mStatisticsTexture; // Texture of the last draw, to count binds
+        unsigned int mBackendTimerDepth; // Nesting of the backend CPU time scopes
+
+        /**
+         * A view change or a draw submitted while a frame was executed.
+         */
+        struct ReplayOperation
+        {
+            sf::View view; // Only for view changes
+            sf::BlendMode blendMode;
+            const sf::Texture* texture;
+            std::size_t firstVertex; // Index into mReplayVertices
+            std::size_t vertexCount; // Zero for view changes
+        };
+
+        bool mCommandRecording;
+        SFMLCommandList mCommandLists[2]; // The frame being recorded and the last one
+        unsigned int mRecordingIndex; // Which of mCommandLists is recorded next
+        SFMLCommandList* mRecordingList; // NULL unless a frame is recorded
+        bool mCapturing; // True while the submitted operations are kept
+        bool mExecutingList; // True inside drawCommandList(), which leaves pixel changes alone
+        std::vector<ReplayOperation> mReplayOperations;
+        std::vector<sf::Vertex> mReplayVertices;
+        bool mReplayValid; // False if the operations can't be replayed
+        sf::View mReplayContextView; // The view the operations were captured with
+        unsigned int mReplayHits;
+        unsigned int mReplayMisses;
+
         /**
          * This offset is used for "exact pixelization".
          * http://www.opengl.org/archives/resources/faq/technical/transformations.htm#tran0030
          */
         static const float PIXEL_ALIGNMENT_OFFSET;
+
+    private:
+        SFMLGraphics(const SFMLGraphics&);
+        SFMLGraphics& operator=(const SFMLGraphics&);
     };
 }
 
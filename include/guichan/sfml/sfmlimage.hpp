@@ -5,7 +5,13 @@
 #include "guichan/platform.hpp"
 #include "guichan/image.hpp"
 
-#include <SFML/Graphics/Image.hpp>
+#include <string>
+#include <vector>
+
+#include <SFML/Config.hpp>
+#include <SFML/Graphics/Rect.hpp>
+#include <SFML/System/Clock.hpp>
+#include <SFML/System/Time.hpp>
 
 namespace sf {
     class Texture;
@@ -13,6 +19,9 @@ namespace sf {
 
 namespace gcn
 {
+    class SFMLImageLoader;
+    class SFMLTextureAtlas;
+
     /**
      * SFML implementation of Image.
      */
@@ -27,6 +36,16 @@ namespace gcn
          */
         SFMLImage(sf::Texture* texture, bool autoFree);
 
+        /**
+         * Constructor. Creates an image from a region of a texture which is
+         * owned by someone else, such as a page of an SFMLTextureAtlas. The
+         * texture is never deleted by the image.
+         *
+         * @param texture the texture to use.
+         * @param textureRect the region of the texture covered by the image.
+         */
+        SFMLImage(sf::Texture* texture, const sf::IntRect& textureRect);
+
         /**
          * Destructor.
          */
@@ -39,6 +58,147 @@ namespace gcn
          */
         virtual sf::Texture* getTexture() const;
 
+        /**
+         * Gets the region of the texture covered by the image. Unless the
+         * image shares its texture with other images this is the whole
+         * texture.
+         *
+         * @return the region of the texture covered by the image.
+         */
+        const sf::IntRect& getTextureRect() const;
+
+        /**
+         * Checks if the image has a texture. Images requested with
+         * SFMLImageLoader::loadAsync() only get one once they are uploaded.
+         *
+         * @return true if the image can be drawn.
+         */
+        bool isLoaded() const;
+
+        /**
+         * Checks if the image is waiting for a background load. Its size is
+         * already known, if the loader could read it from the file.
+         *
+         * @return true until the background load has finished.
+         */
+        bool isPending() const;
+
+        /**
+         * Sets whether getPixel() and putPixel() may be used. Pixel access
+         * needs a copy of the texture in system memory, which is made on
+         * first access by reading the texture back from the graphics card.
+         * Images packed into an SFMLTextureAtlas by SFMLImageLoader share
+         * one readback of the whole page, which is kept by the atlas.
+         * With pixel access disabled the copy is dropped and never made.
+         *
+         * @param pixelAccessEnabled true to allow pixel access.
+         */
+        void setPixelAccessEnabled(bool pixelAccessEnabled);
+
+        /**
+         * Checks if getPixel() and putPixel() may be used.
+         *
+         * @return true if pixel access is allowed.
+         */
+        bool isPixelAccessEnabled() const;
+
+        /**
+         * Drops the copy of the pixels kept in system memory. It is made
+         * again on the next pixel access.
+         */
+        void releasePixelCopy();
+
+        /**
+         * Drops the copy of the pixels kept in system memory if the pixels
+         * haven't been accessed for a while.
+         *
+         * @param idleTime how long the pixels must have been left alone.
+         * @return true if a copy was dropped.
+         */
+        bool releasePixelCopyIfIdle(sf::Time idleTime);
+
+        /**
+         * Starts editing the pixels of the image. putPixel() never uploads
+         * to the texture right away; it records which regions changed. Using
+         * beginEdit() and endEdit() around a batch of changes makes sure they
+         * are uploaded in one go when editing ends.
+         */
+        void beginEdit();
+
+        /**
+         * Stops editing the pixels of the image and uploads the regions
+         * changed since the last upload.
+         */
+        void endEdit();
+
+        /**
+         * Checks if pixels have been changed without being uploaded to the
+         * texture yet.
+         *
+         * @return true if there are changes waiting to be uploaded.
+         */
+        bool hasPendingPixelChanges() const;
+
+        /**
+         * Uploads the regions changed by putPixel() to the texture. Done
+         * automatically by endEdit() and by SFMLGraphics before the image is
+         * drawn.
+         */
+        void uploadPixelChanges() const;
+
+        /**
+         * Copies a rectangle of pixels into a buffer. Much faster than
+         * calling getPixel() for every pixel, since the bounds are checked
+         * once and the colors are converted in bulk.
+         *
+         * @param x the x coordinate of the rectangle.
+         * @param y the y coordinate of the rectangle.
+         * @param width the width of the rectangle.
+         * @param height the height of the rectangle.
+         * @param colors receives width * height colors, row by row.
+         * @throws Exception if the rectangle isn't inside the image.
+         */
+        void readPixels(int x, int y, int width, int height, Color* colors);
+
+        /**
+         * Copies a rectangle of pixels into a buffer of packed 8-bit RGBA
+         * values.
+         *
+         * @param x the x coordinate of the rectangle.
+         * @param y the y coordinate of the rectangle.
+         * @param width the width of the rectangle.
+         * @param height the height of the rectangle.
+         * @param rgba receives width * height * 4 bytes, row by row.
+         * @throws Exception if the rectangle isn't inside the image.
+         */
+        void readPixels(int x, int y, int width, int height, sf::Uint8* rgba);
+
+        /**
+         * Replaces a rectangle of pixels. Color components are clamped to
+         * [0, 255]. Like putPixel(), the texture is updated later.
+         *
+         * @param x the x coordinate of the rectangle.
+         * @param y the y coordinate of the rectangle.
+         * @param width the width of the rectangle.
+         * @param height the height of the rectangle.
+         * @param colors width * height colors, row by row.
+         * @throws Exception if the rectangle isn't inside the image.
+         */
+        void writePixels(int x, int y, int width, int height, const Color* colors);
+
+        /**
+         * Replaces a rectangle of pixels with packed 8-bit RGBA values. Like
+         * putPixel(), the texture is updated later.
+         *
+         * @param x the x coordinate of the rectangle.
+         * @param y the y coordinate of the rectangle.
+         * @param width the width of the rectangle.
+         * @param height the height of the rectangle.
+         * @param rgba width * height * 4 bytes, row by row.
+         * @throws Exception if the rectangle isn't inside the image.
+         */
+        void writePixels(int x, int y, int width, int height, const sf::Uint8* rgba);
+
 
         // Inherited from Image
 
@@ -55,10 +215,49 @@ namespace gcn
         virtual void convertToDisplayFormat();
 
     protected:
+        friend class SFMLImageLoader;
+
+        /**
+         * Makes sure the copy of the pixels in system memory exists, reading
+         * the texture back if needed. Throws if pixel access is disabled.
+         */
+        void preparePixelAccess();
+
+        /**
+         * Checks a rectangle of pixels against the image bounds and makes
+         * sure the pixel copy exists. Throws if either fails.
+         *
+         * @return false if the rectangle is empty.
+         */
+        bool preparePixelRegion(int x, int y, int width, int height);
+
+        /**
+         * Records that an area has changed, growing or merging the dirty
+         * regions as needed.
+         */
+        void markDirty(const sf::IntRect& area);
+
+        /**
+         * The maximum number of separate dirty regions. Beyond that regions
+         * are merged, trading upload size for fewer uploads.
+         */
+        static const unsigned int MAX_DIRTY_RECTS = 4;
+
         sf::Texture* mTexture; // Used to store texture for graphics card
-        sf::Image mImage;     // Used to store texture pixels for manipulation
+        sf::IntRect mTextureRect; // Region of the texture covered by the image
+        std::vector<sf::Uint8> mPixels; // RGBA copy of the texture region for manipulation, made on demand
+        bool mHasPixelCopy;
+        bool mPixelAccessEnabled;
+        sf::Clock mPixelAccessClock; // Time since the last pixel access
+        mutable std::vector<sf::IntRect> mDirtyRects; // Changed regions not uploaded yet
+        bool mEditing;
         bool mAutoFree;
+        bool mSharedTexture; // True if the texture is owned by someone else
+        SFMLImageLoader* mLoader; // Loader the image came from, if any
+        SFMLTextureAtlas* mAtlas; // Atlas of the loader, which may hold the texture
+        std::string mCacheKey;
+        bool mPending; // True while waiting for a background load
     };
 }
 
-#endif // end GCN_SFMLIMAGE_HPP
\ No newline at end of file
+#endif // end GCN_SFMLIMAGE_HPP
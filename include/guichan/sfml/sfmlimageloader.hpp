@@ -1,16 +1,31 @@
 #ifndef GCN_SFMLIMAGELOADER_HPP
 #define GCN_SFMLIMAGELOADER_HPP
 
+#include <cstddef>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "guichan/imageloader.hpp"
 #include "guichan/platform.hpp"
 
+#include <SFML/Graphics/Rect.hpp>
+#include <SFML/System/Mutex.hpp>
+#include <SFML/System/Time.hpp>
+
 namespace sf {
+    class Image;
     class Texture;
 }
 
 namespace gcn
 {
     class Image;
+    class SFMLDiskCache;
+    class SFMLImage;
+    class SFMLTextureAtlas;
 
     /**
      * SFML implementation of ImageLoader.
@@ -19,12 +34,371 @@ namespace gcn
     {
     public:
 
+        /**
+         * Constructor.
+         */
+        SFMLImageLoader();
+
+        /**
+         * Destructor. Deletes the atlas pages and cached textures, so images
+         * using them must not outlive the loader.
+         */
+        virtual ~SFMLImageLoader();
+
+        /**
+         * Enables packing loaded images into shared atlas pages, so images
+         * from the same page can be drawn without a texture switch. Only
+         * images loaded after this call are packed. The atlas can only be
+         * enabled once.
+         *
+         * @param pageSize the width and height of each atlas page.
+         * @param padding the number of transparent pixels on every side of each image.
+         * @param maxImageSize images wider or taller than this get a texture
+         *                     of their own.
+         */
+        void enableAtlas(unsigned int pageSize = 1024,
+                         unsigned int padding = 1,
+                         unsigned int maxImageSize = 256);
+
+        /**
+         * Gets the atlas images are packed into, which can be used to
+         * check how well the atlas pages are used.
+         *
+         * @return the atlas, or NULL if the atlas isn't enabled.
+         */
+        const SFMLTextureAtlas* getAtlas() const;
+
+        /**
+         * Enables keeping decoded images in a directory on disk, so later
+         * runs of the program can skip decoding image files which haven't
+         * changed. Must be enabled before any image is loaded and can only
+         * be enabled once.
+         *
+         * @param directory the directory to keep the decoded images in.
+         * @param maxBytes the size limit of the directory.
+         * @see SFMLDiskCache
+         */
+        void enableDiskCache(const std::string& directory, std::size_t maxBytes = 64 * 1024 * 1024);
+
+        /**
+         * Gets the disk cache, which can be used to check how well it
+         * works.
+         *
+         * @return the disk cache, or NULL if it isn't enabled.
+         */
+        const SFMLDiskCache* getDiskCache() const;
+
+        /**
+         * Sets whether loaded textures are cached by path. With the cache
+         * enabled, loading a file which is already loaded hands out a new
+         * SFMLImage sharing the texture of the first one. The texture is
+         * deleted when the last image using it is freed. Note that
+         * putPixel() on a cached image changes all images of that file.
+         *
+         * @param cacheEnabled true to enable the cache.
+         */
+        void setCacheEnabled(bool cacheEnabled);
+
+        /**
+         * Checks if loaded textures are cached by path.
+         *
+         * @return true if the cache is enabled.
+         */
+        bool isCacheEnabled() const;
+
+        /**
+         * Gets the number of loads which were served by the cache.
+         *
+         * @return the number of cache hits.
+         */
+        unsigned int getCacheHits() const;
+
+        /**
+         * Gets the number of loads which had to decode the file because it
+         * wasn't in the cache.
+         *
+         * @return the number of cache misses.
+         */
+        unsigned int getCacheMisses() const;
+
+        /**
+         * Gets the number of bytes of pixel data held by cached textures.
+         *
+         * @return the resident size of the cache in bytes.
+         */
+        std::size_t getCacheResidentBytes() const;
+
+        /**
+         * Normalizes a path so that different spellings of the same file
+         * map to the same cache entry. Backslashes become slashes, and
+         * empty, "." and resolvable ".." components are removed.
+         *
+         * @param path the path to normalize.
+         * @return the normalized path.
+         */
+        static std::string normalizePath(const std::string& path);
+
+        /**
+         * Starts loading an image in the background and returns right away.
+         * The file is decoded on a pool of worker threads, while the texture
+         * is created later by uploadPendingImages(). Until then the returned
+         * image has no texture: isLoaded() returns false and SFMLGraphics
+         * draws a placeholder for it. Its size is read from the header of
+         * the file right away, so widgets can lay themselves out; it is zero
+         * if the format isn't recognized. If the file can't be loaded the
+         * image simply never becomes loaded.
+         *
+         * The returned image is automatically freed, like images returned
+         * by load(). The atlas and the cache apply to background loads too.
+         *
+         * @param filename the file to load.
+         * @return an image which becomes usable once it is uploaded.
+         */
+        SFMLImage* loadAsync(const std::string& filename);
+
+        /**
+         * Creates textures for images which have been decoded in the
+         * background. Should be called once per frame from the thread which
+         * owns the OpenGL context. Images are uploaded in the order they
+         * were requested until the byte budget is used up; at least one
+         * image is uploaded per call if one is ready.
+         *
+         * @param byteBudget the maximum number of bytes of pixel data to upload.
+         * @return the number of files uploaded.
+         */
+        unsigned int uploadPendingImages(std::size_t byteBudget);
+
+        /**
+         * Blocks until all background loads are decoded and uploads them.
+         * Must be called from the thread which owns the OpenGL context.
+         */
+        void waitForPendingImages();
+
+        /**
+         * Gets the number of files requested with loadAsync() which haven't
+         * been uploaded yet.
+         *
+         * @return the number of pending files.
+         */
+        unsigned int getPendingImageCount() const;
+
+        /**
+         * Sets the number of worker threads used to decode images loaded
+         * with loadAsync(). Can only be set before the first background
+         * load. The default is two.
+         *
+         * @param workerCount the number of worker threads.
+         */
+        void setWorkerCount(unsigned int workerCount);
+
+        /**
+         * Sets whether images loaded from now on support getPixel() and
+         * putPixel(). Images keep no copy of their pixels in system memory
+         * until they are first accessed; with pixel access disabled the copy
+         * is never made and pixel access throws. Enabled by default.
+         *
+         * @param pixelAccessEnabled true to allow pixel access.
+         * @see SFMLImage::setPixelAccessEnabled
+         */
+        void setPixelAccessEnabled(bool pixelAccessEnabled);
+
+        /**
+         * Checks if images loaded from now on support pixel access.
+         *
+         * @return true if pixel access is allowed.
+         */
+        bool isPixelAccessEnabled() const;
+
+        /**
+         * Drops the copies of the pixels kept in system memory for all
+         * images of the loader whose pixels haven't been accessed for a
+         * while. Meant to be called every now and then, for instance once
+         * per second. Idle readbacks of atlas pages are dropped as well.
+         *
+         * @param idleTime how long the pixels must have been left alone.
+         * @return the number of copies dropped.
+         */
+        unsigned int releaseIdlePixelCopies(sf::Time idleTime);
+
+        /**
+         * Loads an image from an encoded image file already in memory, such
+         * as an SFMLMappedFile or a resource compiled into the program. The
+         * memory is only read during the call. The atlas applies, the cache
+         * doesn't.
+         *
+         * @param data the contents of the image file.
+         * @param size the size of the image file in bytes.
+         * @param convertToDisplayFormat true if the image should be converted
+         *                               to display format.
+         * @return the loaded image.
+         * @throws Exception if the image can't be decoded.
+         */
+        Image* loadFromMemory(const void* data, std::size_t size, bool convertToDisplayFormat = true);
+
+        /**
+         * Sets whether image files are memory mapped with SFMLMappedFile
+         * and decoded straight from the mapping instead of being read into
+         * buffers. Should be set before any image is loaded, since it also
+         * applies to the background workers. Disabled by default.
+         *
+         * @param memoryMappingEnabled true to map image files.
+         */
+        void setMemoryMappingEnabled(bool memoryMappingEnabled);
+
+        /**
+         * Checks if image files are memory mapped.
+         *
+         * @return true if image files are memory mapped.
+         */
+        bool isMemoryMappingEnabled() const;
+
         // Inherited from ImageLoader
 
         virtual Image* load(const std::string& filename, bool convertToDisplayFormat = true);
 
     protected:
+        friend class SFMLImage;
+
+        /**
+         * Holds a texture shared by all images loaded from the same file.
+         */
+        struct CacheEntry
+        {
+            sf::Texture* texture;
+            sf::IntRect textureRect;
+            bool ownsTexture; // False if the texture is an atlas page
+            unsigned int references;
+        };
+
+        /**
+         * Loads an image without going through the cache.
+         *
+         * @param filename the file to load.
+         * @return the loaded image, or NULL if the file couldn't be loaded.
+         */
+        SFMLImage* loadUncached(const std::string& filename);
+
+        struct AsyncJob;
+        struct Worker;
+
+        /**
+         * Makes an image known to the loader, so that it is included in
+         * releaseIdlePixelCopies() and comes back through releaseImage()
+         * when freed.
+         *
+         * @param image the image handed out by the loader.
+         */
+        void registerImage(SFMLImage* image);
+
+        /**
+         * Releases an image handed out by the loader. Pending background
+         * loads are cancelled for the image; otherwise a reference to the
+         * cached texture is dropped, deleting the texture when it was the
+         * last one. Called by SFMLImage::free().
+         *
+         * @param image the image being freed.
+         */
+        void releaseImage(SFMLImage* image);
+
+        /**
+         * Drops a reference to a cached texture, deleting the texture when
+         * it was the last one.
+         *
+         * @param key the cache key of the texture.
+         */
+        void releaseCachedTexture(const std::string& key);
+
+        /**
+         * Gives the images waiting for a background load their texture.
+         *
+         * @param job a job which has been decoded.
+         */
+        void finishAsyncJob(AsyncJob* job);
+
+        /**
+         * Entry point of the worker threads. Decodes queued jobs until the
+         * queue is empty.
+         */
+        static void runWorker(Worker* worker);
+
+        /**
+         * Drops the queued background loads and waits for the worker threads
+         * to finish. Subclasses overriding loadSFMLImage() must call this in
+         * their destructor, before the state their override uses is gone.
+         */
+        void stopWorkers();
+
         virtual sf::Texture* loadSFMLTexture(const std::string& filename);
+
+        /**
+         * Decodes an image file into system memory. This is called from the
+         * worker threads for background loads, so overrides must be thread
+         * safe.
+         *
+         * @see stopWorkers
+         *
+         * @param filename the file to load.
+         * @param image the image to decode into.
+         * @return true if the image was loaded.
+         */
+        virtual bool loadSFMLImage(const std::string& filename, sf::Image& image);
+
+        /**
+         * Reads the size of an image without decoding it, from the header
+         * of a PNG, JPEG, BMP or GIF file. Called by loadAsync() for the
+         * size of the pending image.
+         *
+         * @param filename the file to read.
+         * @param size set to the width and height of the image.
+         * @return true if the size could be read.
+         */
+        virtual bool readImageSize(const std::string& filename, sf::Vector2u& size);
+
+        /**
+         * Decodes an image file, going through the disk cache if it is
+         * enabled. Thread safe as long as loadSFMLImage() is.
+         *
+         * @param filename the file to load.
+         * @param image the image to decode into.
+         * @return true if the image was loaded.
+         */
+        bool decodeImage(const std::string& filename, sf::Image& image);
+
+        /**
+         * Creates an SFMLImage from decoded pixels, packing them into the
+         * atlas if it is enabled and the image is small enough.
+         *
+         * @param pixels the pixels of the image.
+         * @return the created image, or NULL if no texture could be created.
+         */
+        SFMLImage* createImage(const sf::Image& pixels);
+
+        SFMLTextureAtlas* mAtlas;
+        unsigned int mAtlasMaxImageSize;
+        SFMLDiskCache* mDiskCache;
+
+        typedef std::map<std::string, CacheEntry> CacheMap;
+
+        CacheMap mCache;
+        bool mCacheEnabled;
+        unsigned int mCacheHits;
+        unsigned int mCacheMisses;
+        std::size_t mCacheResidentBytes;
+
+        std::list<AsyncJob*> mAsyncJobs; // Jobs in request order, render thread only
+        std::list<AsyncJob*> mDecodeQueue; // Jobs waiting for a worker
+        std::vector<Worker*> mWorkers;
+        unsigned int mWorkerCount;
+        bool mShuttingDown;
+        sf::Mutex mMutex; // Guards the decode queue, the workers and job results
+
+        std::set<SFMLImage*> mImages; // Images handed out and not freed yet
+        bool mPixelAccessEnabled;
+        bool mMemoryMappingEnabled;
+
+    private:
+        SFMLImageLoader(const SFMLImageLoader&);
+        SFMLImageLoader& operator=(const SFMLImageLoader&);
     };
 }
 
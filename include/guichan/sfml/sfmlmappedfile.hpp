@@ -0,0 +1,87 @@
+#ifndef GCN_SFMLMAPPEDFILE_HPP
+#define GCN_SFMLMAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "guichan/platform.hpp"
+
+namespace gcn
+{
+    /**
+     * A file mapped read only into memory. The contents are paged in from
+     * the operating system's file cache on demand instead of being copied
+     * into a private buffer, so processes mapping the same file share the
+     * memory. Useful for data SFML must keep alive, such as the file of an
+     * sf::Font loaded from memory.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLMappedFile
+    {
+    public:
+        /**
+         * Constructor. Creates an unmapped file.
+         */
+        SFMLMappedFile();
+
+        /**
+         * Constructor. Maps a file.
+         *
+         * @param filename the file to map.
+         * @throws Exception if the file can't be mapped.
+         */
+        explicit SFMLMappedFile(const std::string& filename);
+
+        /**
+         * Destructor. Unmaps the file.
+         */
+        ~SFMLMappedFile();
+
+        /**
+         * Maps a file, unmapping the previous one.
+         *
+         * @param filename the file to map.
+         * @return true if the file was mapped. Empty files can't be mapped.
+         */
+        bool open(const std::string& filename);
+
+        /**
+         * Unmaps the file. Pointers to its data become invalid.
+         */
+        void close();
+
+        /**
+         * Checks if a file is mapped.
+         *
+         * @return true if a file is mapped.
+         */
+        bool isOpen() const;
+
+        /**
+         * Gets the contents of the file.
+         *
+         * @return the contents, or NULL if no file is mapped.
+         */
+        const void* getData() const;
+
+        /**
+         * Gets the size of the file.
+         *
+         * @return the size in bytes, or zero if no file is mapped.
+         */
+        std::size_t getSize() const;
+
+    protected:
+        const void* mData;
+        std::size_t mSize;
+#ifdef _WIN32
+        void* mFile; // HANDLE of the file
+        void* mMapping; // HANDLE of the file mapping
+#endif
+
+    private:
+        SFMLMappedFile(const SFMLMappedFile&);
+        SFMLMappedFile& operator=(const SFMLMappedFile&);
+    };
+}
+
+#endif // end GCN_SFMLMAPPEDFILE_HPP
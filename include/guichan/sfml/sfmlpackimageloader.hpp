@@ -0,0 +1,70 @@
+#ifndef GCN_SFMLPACKIMAGELOADER_HPP
+#define GCN_SFMLPACKIMAGELOADER_HPP
+
+#include <string>
+
+#include "guichan/platform.hpp"
+#include "guichan/sfml/sfmlassetpack.hpp"
+#include "guichan/sfml/sfmlimageloader.hpp"
+
+namespace gcn
+{
+    /**
+     * An SFMLImageLoader which looks images up in an SFMLAssetPack before
+     * going to the file system. Images found in the pack are already
+     * decoded, so loading one costs no file system calls and no PNG
+     * decoding; uncompressed images are uploaded to their texture straight
+     * from the memory mapping of the pack.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLPackImageLoader : public SFMLImageLoader
+    {
+    public:
+        /**
+         * Constructor.
+         *
+         * @param packFilename the pack to load images from.
+         * @throws Exception if the pack can't be opened.
+         */
+        explicit SFMLPackImageLoader(const std::string& packFilename);
+
+        /**
+         * Destructor.
+         */
+        virtual ~SFMLPackImageLoader();
+
+        /**
+         * Sets whether images missing from the pack are loaded from the file
+         * system. Enabled by default.
+         *
+         * @param fallbackEnabled true to load missing images from files.
+         */
+        void setFallbackEnabled(bool fallbackEnabled);
+
+        /**
+         * Checks if images missing from the pack are loaded from the file
+         * system.
+         *
+         * @return true if missing images are loaded from files.
+         */
+        bool isFallbackEnabled() const;
+
+        /**
+         * Gets the pack images are loaded from.
+         *
+         * @return the pack.
+         */
+        const SFMLAssetPack& getPack() const;
+
+    protected:
+        virtual sf::Texture* loadSFMLTexture(const std::string& filename);
+
+        virtual bool loadSFMLImage(const std::string& filename, sf::Image& image);
+
+        virtual bool readImageSize(const std::string& filename, sf::Vector2u& size);
+
+        SFMLAssetPack mPack;
+        bool mFallbackEnabled;
+    };
+}
+
+#endif // end GCN_SFMLPACKIMAGELOADER_HPP
@@ -0,0 +1,223 @@
+#ifndef GCN_SFMLRENDERTHREAD_HPP
+#define GCN_SFMLRENDERTHREAD_HPP
+
+#include <string>
+
+#include "guichan/platform.hpp"
+#include "guichan/sfml/sfmlgraphics.hpp"
+
+#include <SFML/Graphics/Color.hpp>
+#include <SFML/Graphics/View.hpp>
+#include <SFML/System/Time.hpp>
+
+namespace sf
+{
+    class RenderWindow;
+}
+
+namespace gcn
+{
+    class SFMLCommandList;
+
+    /**
+     * Draws the GUI into a window on a thread of its own. The Graphics
+     * returned by getGraphics() only records the draw calls of a frame into
+     * an SFMLCommandList; _endDraw() hands the list over to the render
+     * thread, which owns the OpenGL context of the window and clears,
+     * draws and displays it. While the render thread submits frame N the
+     * GUI thread can already run the logic of frame N + 1 and record it.
+     *
+     * By default one recorded frame may wait for the render thread; when
+     * the render thread falls further behind, _endDraw() blocks until it
+     * catches up. With stale frames dropped, a new frame replaces the frames
+     * still waiting instead, so the GUI thread never blocks and the window
+     * always shows the newest frame.
+     *
+     * The window must only be used for events on the GUI thread; views and
+     * the clear color are set through the render thread. Images and fonts
+     * drawn in a frame must stay alive until the frame has been drawn, see
+     * waitUntilIdle(). Fonts lock their face while measuring and drawing,
+     * so they may be used on both threads.
+     *
+     * The pixels of an image are only touched on the GUI thread: changes
+     * made with putPixel() or writePixels() are uploaded when a frame
+     * drawing the image is recorded, or by endEdit(), and the render thread
+     * never uploads them. An upload changes the texture shared by the
+     * frames still queued, so they may show the new pixels already; call
+     * waitUntilIdle() before editing an image if that matters.
+     *
+     * The render thread needs C++11 and is only started when the library
+     * is built with GCN_SFML_ENABLE_RENDER_THREAD. Without it, frames are
+     * drawn right away in _endDraw() on the calling thread.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLRenderThread
+    {
+    public:
+        /**
+         * Counters of the frames passed to the render thread.
+         */
+        struct Statistics
+        {
+            unsigned int submittedFrames;
+            unsigned int renderedFrames;
+            unsigned int droppedFrames; // Replaced by a newer frame before they were drawn
+            sf::Time stallTime; // Time the GUI thread waited for the render thread
+        };
+
+        /**
+         * Constructor. Deactivates the window on the calling thread and
+         * starts the render thread.
+         *
+         * @param window the window to draw into, which must outlive the
+         *               render thread.
+         */
+        SFMLRenderThread(sf::RenderWindow& window);
+
+        /**
+         * Destructor. Draws the frames still waiting, stops the render
+         * thread and activates the window on the calling thread again.
+         */
+        ~SFMLRenderThread();
+
+        /**
+         * Gets the Graphics which records frames for the render thread,
+         * to be passed to Gui::setGraphics(). Only to be used on one
+         * thread, the GUI thread.
+         *
+         * @return the recording Graphics.
+         */
+        SFMLGraphics& getGraphics();
+
+        /**
+         * Sets the view of the window for the frames recorded from now on,
+         * for example after the window was resized.
+         *
+         * @param view the view.
+         */
+        void setView(const sf::View& view);
+
+        /**
+         * Gets the view of the window the frames are recorded for.
+         *
+         * @return the view.
+         */
+        const sf::View& getView() const;
+
+        /**
+         * Sets the color the window is cleared with before a frame is
+         * drawn. The default is black.
+         *
+         * @param color the clear color.
+         */
+        void setClearColor(const sf::Color& color);
+
+        /**
+         * Gets the color the window is cleared with.
+         *
+         * @return the clear color.
+         */
+        const sf::Color& getClearColor() const;
+
+        /**
+         * Sets how many recorded frames may wait for the render thread
+         * before _endDraw() blocks. The default is 1.
+         *
+         * @param frames the number of frames, at least 1.
+         */
+        void setMaxQueuedFrames(unsigned int frames);
+
+        /**
+         * Gets how many recorded frames may wait for the render thread.
+         *
+         * @return the number of frames.
+         */
+        unsigned int getMaxQueuedFrames() const;
+
+        /**
+         * Sets whether a new frame replaces the frames still waiting for the
+         * render thread, instead of waiting for room in the queue.
+         *
+         * @param droppingStaleFrames true to drop stale frames.
+         */
+        void setDroppingStaleFrames(bool droppingStaleFrames);
+
+        /**
+         * Checks whether stale frames are dropped.
+         *
+         * @return true if stale frames are dropped.
+         */
+        bool isDroppingStaleFrames() const;
+
+        /**
+         * Waits until all submitted frames have been drawn, for example
+         * before images or fonts used by them are destroyed.
+         */
+        void waitUntilIdle();
+
+        /**
+         * Gets the counters of the frames passed to the render thread.
+         *
+         * @return the statistics.
+         */
+        Statistics getStatistics() const;
+
+    protected:
+        class Recorder;
+        struct Pipeline;
+
+        /**
+         * A recorded frame and what it is drawn with.
+         */
+        struct Frame
+        {
+            SFMLCommandList* list;
+            sf::View view;
+            sf::Color clearColor;
+        };
+
+        /**
+         * Gets an unused command list to record a frame into.
+         */
+        SFMLCommandList* acquireCommandList();
+
+        /**
+         * Passes a recorded frame to the render thread, waiting for room in
+         * the queue or dropping the frames still in it.
+         */
+        void submit(SFMLCommandList* list);
+
+        /**
+         * Entry point of the render thread. Draws queued frames until the
+         * render thread is stopped and the queue is empty.
+         */
+        void run();
+
+        /**
+         * Clears, draws and displays the window. If drawing throws, the
+         * frame is abandoned before the exception is passed on.
+         */
+        void renderFrame(const Frame& frame);
+
+        /**
+         * Throws if the render thread failed to draw a frame.
+         */
+        void checkError();
+
+        sf::RenderWindow& mWindow;
+        SFMLGraphics mGraphics; // Draws the frames, render thread only
+        Recorder* mRecorder;
+        Pipeline* mPipeline;
+
+        // Settings used on the GUI thread only
+        sf::View mView;
+        sf::Color mClearColor;
+        unsigned int mMaxQueuedFrames;
+        bool mDroppingStaleFrames;
+
+    private:
+        SFMLRenderThread(const SFMLRenderThread&);
+        SFMLRenderThread& operator=(const SFMLRenderThread&);
+    };
+}
+
+#endif // end GCN_SFMLRENDERTHREAD_HPP
@@ -0,0 +1,168 @@
+#ifndef GCN_SFMLTEXTUREATLAS_HPP
+#define GCN_SFMLTEXTUREATLAS_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "guichan/platform.hpp"
+
+#include <SFML/Graphics/Rect.hpp>
+#include <SFML/System/Clock.hpp>
+#include <SFML/System/Time.hpp>
+
+namespace sf
+{
+    class Image;
+    class Texture;
+}
+
+namespace gcn
+{
+    /**
+     * Packs small images into a few large textures, called pages, so that
+     * drawing them doesn't require a texture switch. Images are packed on
+     * shelves: rows of a page whose height is set by the first image placed
+     * in them. Space is never reclaimed, the pages live as long as the
+     * atlas does.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLTextureAtlas
+    {
+    public:
+        /**
+         * Constructor.
+         *
+         * @param pageSize the width and height of each page in pixels.
+         * @param padding the number of transparent pixels kept on every side
+         *                of each image.
+         */
+        SFMLTextureAtlas(unsigned int pageSize = 1024, unsigned int padding = 1);
+
+        /**
+         * Destructor. Deletes all pages.
+         */
+        ~SFMLTextureAtlas();
+
+        /**
+         * Packs an image into one of the pages, adding a new page if none
+         * of the existing ones has room for it.
+         *
+         * @param image the image to pack.
+         * @param rectangle set to the area of the page the image was copied to.
+         * @return the page the image was packed into, or NULL if the image
+         *         is too large to fit into a page.
+         */
+        sf::Texture* insert(const sf::Image& image, sf::IntRect& rectangle);
+
+        /**
+         * Gets the width and height of each page.
+         *
+         * @return the size of a page in pixels.
+         */
+        unsigned int getPageSize() const;
+
+        /**
+         * Gets the number of transparent pixels kept on every side of each
+         * image.
+         *
+         * @return the padding in pixels.
+         */
+        unsigned int getPadding() const;
+
+        /**
+         * Gets the number of pages allocated so far.
+         *
+         * @return the number of pages.
+         */
+        unsigned int getPageCount() const;
+
+        /**
+         * Gets the number of pixels covered by packed images, over all pages.
+         *
+         * @return the used area in pixels.
+         */
+        std::size_t getUsedArea() const;
+
+        /**
+         * Gets how well the pages are used, as the fraction of the area of
+         * all pages which is covered by packed images.
+         *
+         * @return the utilization, between 0 and 1.
+         */
+        float getUtilization() const;
+
+        /**
+         * Gets a copy of the pixels of a page in system memory. The page is
+         * read back from the graphics card on the first call and the copy is
+         * shared by all images packed into it, so getting the pixels of many
+         * small images costs a single readback per page.
+         *
+         * @param page the texture of a page.
+         * @return the pixels of the page, or NULL if the texture isn't a
+         *         page of this atlas.
+         */
+        const sf::Image* getPagePixels(const sf::Texture* page);
+
+        /**
+         * Drops the copy of the pixels of a page, because the texture was
+         * changed by someone other than the atlas.
+         *
+         * @param page the texture of a page. Other textures are ignored.
+         */
+        void invalidatePagePixels(const sf::Texture* page);
+
+        /**
+         * Drops the copies of the pixels of pages which haven't been asked
+         * for in a while.
+         *
+         * @param idleTime how long the pixels must have been left alone.
+         * @return the number of copies dropped.
+         */
+        unsigned int releaseIdlePagePixels(sf::Time idleTime);
+
+    protected:
+        /**
+         * A row of a page holding images of similar height.
+         */
+        struct Shelf
+        {
+            unsigned int y;
+            unsigned int height;
+            unsigned int width; // Width used so far
+        };
+
+        struct Page
+        {
+            sf::Texture* texture;
+            std::vector<Shelf> shelves;
+            unsigned int height; // Height used by shelves so far
+            sf::Image* pixels; // Copy of the texture read back, NULL if none
+            sf::Clock pixelsClock; // Time since the pixels were last asked for
+        };
+
+        /**
+         * Finds the page of a texture.
+         *
+         * @return the page, or NULL if the texture isn't a page.
+         */
+        Page* findPage(const sf::Texture* texture);
+
+        /**
+         * Finds room for an image of the given size in a page.
+         *
+         * @return true if the page has room, in which case the position is
+         *         set to where the image should be placed.
+         */
+        bool allocate(Page& page, unsigned int width, unsigned int height, sf::Vector2u& position);
+
+        std::vector<Page> mPages;
+        unsigned int mPageSize;
+        unsigned int mPadding;
+        std::size_t mUsedArea;
+
+    private:
+        SFMLTextureAtlas(const SFMLTextureAtlas&);
+        SFMLTextureAtlas& operator=(const SFMLTextureAtlas&);
+    };
+}
+
+#endif // end GCN_SFMLTEXTUREATLAS_HPP
@@ -0,0 +1,125 @@
+#ifndef GCN_SFMLTRACE_HPP
+#define GCN_SFMLTRACE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "guichan/platform.hpp"
+
+#include <SFML/Config.hpp>
+
+namespace gcn
+{
+    /**
+     * Records spans of time spent in the hot paths of the backend, such as
+     * drawing, clipping, font measuring, image loading and input dispatch,
+     * and writes them as Chrome trace JSON, which chrome://tracing and
+     * Perfetto can open.
+     *
+     * Spans are only recorded when the library is built with
+     * GCN_SFML_ENABLE_TRACING, which needs C++11. Each thread records into
+     * a ring buffer of its own without taking any locks; when a ring is
+     * full its oldest spans are overwritten. Without GCN_SFML_ENABLE_TRACING
+     * GCN_SFML_TRACE_SCOPE expands to nothing and writeChromeTrace() writes
+     * an empty trace.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLTrace
+    {
+    public:
+        /**
+         * The number of spans each thread keeps.
+         */
+        static const std::size_t RING_SIZE = 16384;
+
+        /**
+         * Sets whether spans are recorded. Enabled by default.
+         *
+         * @param enabled true to record spans.
+         */
+        static void setEnabled(bool enabled);
+
+        /**
+         * Checks if spans are recorded.
+         *
+         * @return true if spans are recorded, false if they are not or the
+         *         library was built without GCN_SFML_ENABLE_TRACING.
+         */
+        static bool isEnabled();
+
+        /**
+         * Sets the name the calling thread is shown with in the trace.
+         *
+         * @param name the name of the thread.
+         */
+        static void setThreadName(const std::string& name);
+
+        /**
+         * Writes the spans recorded so far by all threads as Chrome trace
+         * JSON. May be called while other threads are recording; spans
+         * overwritten while the trace is written are left out.
+         *
+         * @param filename the file to write.
+         * @return true if the file was written.
+         */
+        static bool writeChromeTrace(const std::string& filename);
+
+        /**
+         * Forgets the spans recorded so far by all threads.
+         */
+        static void clear();
+
+        /**
+         * Gets the time spans are measured with.
+         *
+         * @return nanoseconds since tracing started.
+         */
+        static sf::Int64 now();
+
+        /**
+         * Records a span on the calling thread.
+         *
+         * @param name the name of the span. Only the pointer is kept, so it
+         *             must stay valid, such as a string literal.
+         * @param start when the span started, as returned by now().
+         * @param end when the span ended, as returned by now().
+         */
+        static void record(const char* name, sf::Int64 start, sf::Int64 end);
+    };
+
+    /**
+     * Records a span from its construction to its destruction. Used through
+     * GCN_SFML_TRACE_SCOPE.
+     */
+    class GCN_EXTENSION_DECLSPEC SFMLTraceScope
+    {
+    public:
+        /**
+         * Constructor. Starts the span.
+         *
+         * @param name the name of the span, such as a string literal.
+         */
+        explicit SFMLTraceScope(const char* name);
+
+        /**
+         * Destructor. Records the span.
+         */
+        ~SFMLTraceScope();
+
+    private:
+        SFMLTraceScope(const SFMLTraceScope&);
+        SFMLTraceScope& operator=(const SFMLTraceScope&);
+
+        const char* mName;
+        sf::Int64 mStart; // Negative if tracing was disabled at the start
+    };
+}
+
+#ifdef GCN_SFML_ENABLE_TRACING
+#define GCN_SFML_TRACE_CONCATENATE2(a, b) a##b
+#define GCN_SFML_TRACE_CONCATENATE(a, b) GCN_SFML_TRACE_CONCATENATE2(a, b)
+#define GCN_SFML_TRACE_SCOPE(name) gcn::SFMLTraceScope GCN_SFML_TRACE_CONCATENATE(gcnTraceScope, __LINE__)(name)
+#else
+#define GCN_SFML_TRACE_SCOPE(name) ((void)0)
+#endif
+
+#endif // end GCN_SFMLTRACE_HPP
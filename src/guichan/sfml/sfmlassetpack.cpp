@@ -0,0 +1,241 @@
+#include "guichan/sfml/sfmlassetpack.hpp"
+
+#include <vector>
+
+#include <SFML/Graphics/Image.hpp>
+
+#ifdef GCN_SFML_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#include "guichan/exception.hpp"
+
+namespace
+{
+    /**
+     * Orders names the same way std::string does.
+     */
+    int compareNames(const char* a, std::size_t aLength, const char* b, std::size_t bLength)
+    {
+        const std::string::size_type length = aLength < bLength ? aLength : bLength;
+        const int result = std::string::traits_type::compare(a, b, length);
+
+        if (result != 0)
+        {
+            return result;
+        }
+
+        return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+    }
+}
+
+namespace gcn
+{
+    SFMLAssetPack::SFMLAssetPack()
+    {
+    }
+
+    SFMLAssetPack::SFMLAssetPack(const std::string& filename)
+    {
+        if (!open(filename))
+        {
+            throw GCN_EXCEPTION("Unable to open asset pack \"" + filename + "\"");
+        }
+    }
+
+    bool SFMLAssetPack::open(const std::string& filename)
+    {
+        close();
+
+        if (!mFile.open(filename) || !readIndex())
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void SFMLAssetPack::close()
+    {
+        mEntries.clear();
+        mFile.close();
+    }
+
+    bool SFMLAssetPack::isOpen() const
+    {
+        return mFile.isOpen();
+    }
+
+    const SFMLAssetPack::Entry* SFMLAssetPack::find(const std::string& name) const
+    {
+        std::size_t low = 0;
+        std::size_t high = mEntries.size();
+
+        while (low < high)
+        {
+            const std::size_t middle = low + (high - low) / 2;
+            const Entry& entry = mEntries[middle];
+            const int order = compareNames(entry.name, entry.nameLength, name.data(), name.size());
+
+            if (order == 0)
+            {
+                return &entry;
+            }
+
+            if (order < 0)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        return NULL;
+    }
+
+    std::size_t SFMLAssetPack::getEntryCount() const
+    {
+        return mEntries.size();
+    }
+
+    const SFMLAssetPack::Entry& SFMLAssetPack::getEntry(std::size_t index) const
+    {
+        if (index >= mEntries.size())
+        {
+            throw GCN_EXCEPTION("Asset pack entry index out of range");
+        }
+
+        return mEntries[index];
+    }
+
+    bool SFMLAssetPack::decode(const Entry& entry, sf::Image& image) const
+    {
+        const std::size_t pixelBytes = static_cast<std::size_t>(entry.width) * entry.height * 4;
+
+        if (entry.compression == None)
+        {
+            image.create(entry.width, entry.height, entry.data);
+            return true;
+        }
+
+#ifdef GCN_SFML_WITH_LZ4
+        if (entry.compression == LZ4)
+        {
+            std::vector<sf::Uint8> pixels(pixelBytes);
+
+            const int decompressed = LZ4_decompress_safe(reinterpret_cast<const char*>(entry.data),
+                                                         reinterpret_cast<char*>(&pixels[0]),
+                                                         static_cast<int>(entry.dataSize),
+                                                         static_cast<int>(pixelBytes));
+
+            if (decompressed != static_cast<int>(pixelBytes))
+            {
+                return false;
+            }
+
+            image.create(entry.width, entry.height, &pixels[0]);
+            return true;
+        }
+#else
+        (void)pixelBytes;
+#endif
+
+        return false;
+    }
+
+    sf::Uint32 SFMLAssetPack::readUint32(const sf::Uint8* data)
+    {
+        return static_cast<sf::Uint32>(data[0])
+               | (static_cast<sf::Uint32>(data[1]) << 8)
+               | (static_cast<sf::Uint32>(data[2]) << 16)
+               | (static_cast<sf::Uint32>(data[3]) << 24);
+    }
+
+    void SFMLAssetPack::writeUint32(sf::Uint8* data, sf::Uint32 value)
+    {
+        data[0] = static_cast<sf::Uint8>(value);
+        data[1] = static_cast<sf::Uint8>(value >> 8);
+        data[2] = static_cast<sf::Uint8>(value >> 16);
+        data[3] = static_cast<sf::Uint8>(value >> 24);
+    }
+
+    bool SFMLAssetPack::readIndex()
+    {
+        const sf::Uint8* file = static_cast<const sf::Uint8*>(mFile.getData());
+        const std::size_t fileSize = mFile.getSize();
+
+        if (fileSize < HEADER_SIZE
+            || readUint32(file) != MAGIC
+            || readUint32(file + 4) != VERSION)
+        {
+            return false;
+        }
+
+        const std::size_t count = readUint32(file + 8);
+
+        if (count > (fileSize - HEADER_SIZE) / ENTRY_SIZE)
+        {
+            return false;
+        }
+
+        mEntries.reserve(count);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const sf::Uint8* record = file + HEADER_SIZE + i * ENTRY_SIZE;
+
+            const std::size_t nameOffset = readUint32(record);
+            const std::size_t nameLength = readUint32(record + 4);
+            const sf::Uint32 dataOffsetLow = readUint32(record + 8);
+            const sf::Uint32 dataOffsetHigh = readUint32(record + 12);
+            const std::size_t dataSize = readUint32(record + 16);
+
+            // Everything must lie inside the file, which can't be larger
+            // than the address space since it is mapped.
+            if (dataOffsetHigh != 0 && sizeof(std::size_t) <= 4)
+            {
+                return false;
+            }
+
+            const sf::Uint64 dataOffset = (static_cast<sf::Uint64>(dataOffsetHigh) << 32) | dataOffsetLow;
+
+            if (nameOffset > fileSize
+                || nameLength > fileSize - nameOffset
+                || dataOffset > fileSize
+                || dataSize > fileSize - dataOffset)
+            {
+                return false;
+            }
+
+            Entry entry;
+            entry.name = reinterpret_cast<const char*>(file + nameOffset);
+            entry.nameLength = nameLength;
+            entry.data = file + dataOffset;
+            entry.dataSize = dataSize;
+            entry.width = readUint32(record + 20);
+            entry.height = readUint32(record + 24);
+            entry.compression = static_cast<Compression>(readUint32(record + 28));
+
+            if (entry.compression == None
+                && static_cast<sf::Uint64>(entry.width) * entry.height * 4 != dataSize)
+            {
+                return false;
+            }
+
+            // The index must be sorted for the binary search in find().
+            if (!mEntries.empty()
+                && compareNames(mEntries.back().name, mEntries.back().nameLength,
+                                entry.name, entry.nameLength) >= 0)
+            {
+                return false;
+            }
+
+            mEntries.push_back(entry);
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,1009 @@
+#include "guichan/sfml/sfmlcommandlist.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <SFML/Graphics/Image.hpp>
+#include <SFML/Graphics/Texture.hpp>
+
+#include "guichan/exception.hpp"
+#include "guichan/font.hpp"
+#include "guichan/sfml/sfmlassetpack.hpp"
+#include "guichan/sfml/sfmldiskcache.hpp"
+#include "guichan/sfml/sfmlfont.hpp"
+#include "guichan/sfml/sfmlimage.hpp"
+
+namespace
+{
+    sf::Uint32 packColor(const gcn::Color& color)
+    {
+        return (static_cast<sf::Uint32>(color.r) << 24)
+               | (static_cast<sf::Uint32>(color.g) << 16)
+               | (static_cast<sf::Uint32>(color.b) << 8)
+               | static_cast<sf::Uint32>(color.a);
+    }
+
+    sf::Uint32 packColor(const sf::Color& color)
+    {
+        return (static_cast<sf::Uint32>(color.r) << 24)
+               | (static_cast<sf::Uint32>(color.g) << 16)
+               | (static_cast<sf::Uint32>(color.b) << 8)
+               | static_cast<sf::Uint32>(color.a);
+    }
+
+    /**
+     * A draw command of a list with the state it is drawn in.
+     */
+    struct DrawnCommand
+    {
+        const gcn::SFMLCommandList::Command* command;
+        gcn::Rectangle clip; // The clip area in target space
+        int xOffset;
+        int yOffset;
+        const sf::BlendMode* blendMode; // NULL until the list sets one
+        gcn::Rectangle bounds; // What the command covers in target space, inside the clip area
+    };
+
+    gcn::Rectangle intersect(const gcn::Rectangle& a, const gcn::Rectangle& b)
+    {
+        const int left = std::max(a.x, b.x);
+        const int top = std::max(a.y, b.y);
+        const int right = std::min(a.x + a.width, b.x + b.width);
+        const int bottom = std::min(a.y + a.height, b.y + b.height);
+
+        if (left >= right || top >= bottom)
+        {
+            return gcn::Rectangle(0, 0, 0, 0);
+        }
+
+        return gcn::Rectangle(left, top, right - left, bottom - top);
+    }
+
+    void unite(gcn::Rectangle& area, const gcn::Rectangle& other)
+    {
+        if (other.width <= 0 || other.height <= 0)
+        {
+            return;
+        }
+
+        if (area.width <= 0 || area.height <= 0)
+        {
+            area = other;
+            return;
+        }
+
+        const int left = std::min(area.x, other.x);
+        const int top = std::min(area.y, other.y);
+        const int right = std::max(area.x + area.width, other.x + other.width);
+        const int bottom = std::max(area.y + area.height, other.y + other.height);
+
+        area = gcn::Rectangle(left, top, right - left, bottom - top);
+    }
+
+    /**
+     * Gets what a draw command covers in target space, before clipping.
+     */
+    gcn::Rectangle getCommandBounds(const gcn::SFMLCommandList& list,
+                                    const gcn::SFMLCommandList::Command& command,
+                                    int xOffset,
+                                    int yOffset)
+    {
+        switch (command.type)
+        {
+            case gcn::SFMLCommandList::FillRectangle:
+            case gcn::SFMLCommandList::DrawRectangle:
+            case gcn::SFMLCommandList::DrawImage:
+                return gcn::Rectangle(command.x + xOffset, command.y + yOffset, command.width, command.height);
+            case gcn::SFMLCommandList::DrawLine:
+                return gcn::Rectangle(std::min(command.x, command.width) + xOffset,
+                                      std::min(command.y, command.height) + yOffset,
+                                      std::abs(command.width - command.x) + 1,
+                                      std::abs(command.height - command.y) + 1);
+            case gcn::SFMLCommandList::DrawPoint:
+                return gcn::Rectangle(command.x + xOffset, command.y + yOffset, 1, 1);
+            case gcn::SFMLCommandList::DrawText:
+            {
+                gcn::Font* font = list.getFont(command.resource);
+
+                if (font == NULL)
+                {
+                    return gcn::Rectangle(0, 0, 0, 0);
+                }
+
+                const std::string& text = list.getString(command.first);
+                gcn::SFMLFont* sfmlFont = dynamic_cast<gcn::SFMLFont*>(font);
+
+                if (sfmlFont == NULL)
+                {
+                    return gcn::Rectangle(command.x + xOffset, command.y + yOffset, font->getWidth(text), font->getHeight());
+                }
+
+                const sf::Color color(command.color >> 24,
+                                      (command.color >> 16) & 0xff,
+                                      (command.color >> 8) & 0xff,
+                                      command.color & 0xff);
+                const sf::FloatRect bounds = sfmlFont->getStringBounds(text, color);
+                const int left = static_cast<int>(std::floor(bounds.left));
+                const int top = static_cast<int>(std::floor(bounds.top));
+
+                return gcn::Rectangle(left + command.x + xOffset,
+                                      top + command.y + yOffset,
+                                      static_cast<int>(std::ceil(bounds.left + bounds.width)) - left,
+                                      static_cast<int>(std::ceil(bounds.top + bounds.height)) - top);
+            }
+            case gcn::SFMLCommandList::DrawTexturedQuads:
+            {
+                if (command.count == 0)
+                {
+                    return gcn::Rectangle(0, 0, 0, 0);
+                }
+
+                // The vertices are in target space already.
+                const sf::Vertex* vertices = &list.getVertices()[command.first];
+                sf::Vector2f minimum = vertices[0].position;
+                sf::Vector2f maximum = vertices[0].position;
+
+                for (sf::Uint32 i = 1; i < command.count; ++i)
+                {
+                    minimum.x = std::min(minimum.x, vertices[i].position.x);
+                    minimum.y = std::min(minimum.y, vertices[i].position.y);
+                    maximum.x = std::max(maximum.x, vertices[i].position.x);
+                    maximum.y = std::max(maximum.y, vertices[i].position.y);
+                }
+
+                const int left = static_cast<int>(std::floor(minimum.x));
+                const int top = static_cast<int>(std::floor(minimum.y));
+
+                return gcn::Rectangle(left,
+                                      top,
+                                      static_cast<int>(std::ceil(maximum.x)) - left,
+                                      static_cast<int>(std::ceil(maximum.y)) - top);
+            }
+            default:
+                return gcn::Rectangle(0, 0, 0, 0);
+        }
+    }
+
+    /**
+     * Lists the draw commands of a list, following its clip areas the way
+     * Graphics::pushClipArea() does.
+     *
+     * @return false if the list pops more clip areas than it pushes.
+     */
+    bool getDrawnCommands(const gcn::SFMLCommandList& list,
+                          const gcn::Rectangle& root,
+                          std::vector<DrawnCommand>& drawn)
+    {
+        const std::vector<gcn::SFMLCommandList::Command>& commands = list.getCommands();
+
+        DrawnCommand state;
+        state.command = NULL;
+        state.clip = root;
+        state.xOffset = root.x;
+        state.yOffset = root.y;
+        state.blendMode = NULL;
+
+        std::vector<DrawnCommand> clipStack;
+
+        for (std::size_t i = 0; i < commands.size(); ++i)
+        {
+            const gcn::SFMLCommandList::Command& command = commands[i];
+
+            switch (command.type)
+            {
+                case gcn::SFMLCommandList::PushClipArea:
+                    clipStack.push_back(state);
+                    state.clip = intersect(gcn::Rectangle(command.x + state.xOffset,
+                                                          command.y + state.yOffset,
+                                                          command.width,
+                                                          command.height),
+                                           state.clip);
+                    state.xOffset += command.x;
+                    state.yOffset += command.y;
+                    break;
+                case gcn::SFMLCommandList::PopClipArea:
+                    if (clipStack.empty())
+                    {
+                        return false;
+                    }
+
+                    // The blend mode isn't part of the clip area.
+                    clipStack.back().blendMode = state.blendMode;
+                    state = clipStack.back();
+                    clipStack.pop_back();
+                    break;
+                case gcn::SFMLCommandList::SetBlendMode:
+                    state.blendMode = &list.getBlendMode(command.resource);
+                    break;
+                default:
+                    state.command = &command;
+                    state.bounds = intersect(getCommandBounds(list, command, state.xOffset, state.yOffset), state.clip);
+                    drawn.push_back(state);
+                    break;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Checks if two draw commands draw the same, comparing the resources
+     * they refer to instead of their indices in the lists.
+     */
+    bool drawSame(const gcn::SFMLCommandList& list,
+                  const DrawnCommand& a,
+                  const gcn::SFMLCommandList& otherList,
+                  const DrawnCommand& b)
+    {
+        const gcn::SFMLCommandList::Command& command = *a.command;
+        const gcn::SFMLCommandList::Command& other = *b.command;
+
+        if (command.type != other.type
+            || command.x != other.x
+            || command.y != other.y
+            || command.width != other.width
+            || command.height != other.height
+            || command.srcX != other.srcX
+            || command.srcY != other.srcY
+            || command.color != other.color
+            || command.count != other.count
+            || a.xOffset != b.xOffset
+            || a.yOffset != b.yOffset
+            || a.clip.x != b.clip.x
+            || a.clip.y != b.clip.y
+            || a.clip.width != b.clip.width
+            || a.clip.height != b.clip.height)
+        {
+            return false;
+        }
+
+        if (a.blendMode == NULL || b.blendMode == NULL ? a.blendMode != b.blendMode : *a.blendMode != *b.blendMode)
+        {
+            return false;
+        }
+
+        switch (command.type)
+        {
+            case gcn::SFMLCommandList::DrawImage:
+                return list.getImage(command.resource) == otherList.getImage(other.resource);
+            case gcn::SFMLCommandList::DrawText:
+                return list.getFont(command.resource) == otherList.getFont(other.resource)
+                       && list.getString(command.first) == otherList.getString(other.first);
+            case gcn::SFMLCommandList::DrawTexturedQuads:
+                return list.getTexture(command.resource) == otherList.getTexture(other.resource)
+                       && (command.count == 0
+                           || std::memcmp(&list.getVertices()[command.first],
+                                          &otherList.getVertices()[other.first],
+                                          command.count * sizeof(sf::Vertex)) == 0);
+            default:
+                return true;
+        }
+    }
+
+    gcn::SFMLCommandList::Command makeCommand(gcn::SFMLCommandList::Type type)
+    {
+        gcn::SFMLCommandList::Command command;
+        std::memset(&command, 0, sizeof(command));
+        command.type = type;
+
+        return command;
+    }
+
+    /**
+     * Appends little endian numbers to a buffer.
+     */
+    class Writer
+    {
+    public:
+        Writer(std::vector<sf::Uint8>& buffer)
+            : mBuffer(buffer)
+        {
+        }
+
+        void writeUint32(sf::Uint32 value)
+        {
+            sf::Uint8 bytes[4];
+            gcn::SFMLAssetPack::writeUint32(bytes, value);
+            mBuffer.insert(mBuffer.end(), bytes, bytes + 4);
+        }
+
+        void writeFloat(float value)
+        {
+            sf::Uint32 bits;
+            std::memcpy(&bits, &value, 4);
+            writeUint32(bits);
+        }
+
+        void writeBytes(const void* data, std::size_t size)
+        {
+            const sf::Uint8* bytes = static_cast<const sf::Uint8*>(data);
+            mBuffer.insert(mBuffer.end(), bytes, bytes + size);
+        }
+
+        void writeString(const std::string& text)
+        {
+            writeUint32(static_cast<sf::Uint32>(text.size()));
+            writeBytes(text.data(), text.size());
+        }
+
+        void writePixels(const sf::Image& image)
+        {
+            writeUint32(image.getSize().x);
+            writeUint32(image.getSize().y);
+            writeBytes(image.getPixelsPtr(), static_cast<std::size_t>(image.getSize().x) * image.getSize().y * 4);
+        }
+
+    private:
+        std::vector<sf::Uint8>& mBuffer;
+    };
+
+    /**
+     * Reads little endian numbers from a buffer, failing instead of reading
+     * past its end.
+     */
+    class Reader
+    {
+    public:
+        Reader(const std::vector<sf::Uint8>& buffer)
+            : mBuffer(buffer),
+              mPosition(0),
+              mFailed(false)
+        {
+        }
+
+        bool hasFailed() const
+        {
+            return mFailed;
+        }
+
+        const sf::Uint8* readBytes(std::size_t size)
+        {
+            if (mFailed || mBuffer.size() - mPosition < size)
+            {
+                mFailed = true;
+                return NULL;
+            }
+
+            const sf::Uint8* bytes = mBuffer.empty() ? NULL : &mBuffer[0] + mPosition;
+            mPosition += size;
+
+            return bytes;
+        }
+
+        sf::Uint32 readUint32()
+        {
+            const sf::Uint8* bytes = readBytes(4);
+            return bytes != NULL ? gcn::SFMLAssetPack::readUint32(bytes) : 0;
+        }
+
+        float readFloat()
+        {
+            const sf::Uint32 bits = readUint32();
+            float value;
+            std::memcpy(&value, &bits, 4);
+
+            return value;
+        }
+
+        std::string readString()
+        {
+            const sf::Uint32 size = readUint32();
+            const sf::Uint8* bytes = readBytes(size);
+
+            return bytes != NULL ? std::string(reinterpret_cast<const char*>(bytes), size) : std::string();
+        }
+
+        bool readPixels(sf::Image& image)
+        {
+            const sf::Uint64 width = readUint32();
+            const sf::Uint64 height = readUint32();
+
+            if (mFailed || width * height * 4 > mBuffer.size() - mPosition)
+            {
+                mFailed = true;
+                return false;
+            }
+
+            const sf::Uint8* pixels = readBytes(static_cast<std::size_t>(width * height * 4));
+            image.create(static_cast<unsigned int>(width), static_cast<unsigned int>(height), pixels);
+
+            return true;
+        }
+
+    private:
+        const std::vector<sf::Uint8>& mBuffer;
+        std::size_t mPosition;
+        bool mFailed;
+    };
+}
+
+namespace gcn
+{
+    SFMLCommandList::SFMLCommandList()
+        : mHash(SFMLDiskCache::hash(NULL, 0))
+    {
+    }
+
+    SFMLCommandList::~SFMLCommandList()
+    {
+        clear();
+    }
+
+    void SFMLCommandList::clear()
+    {
+        // Keep the capacity around so the next frame doesn't reallocate.
+        mCommands.clear();
+        mStrings.clear();
+        mVertices.clear();
+        mBlendModes.clear();
+        mTextures.clear();
+        mImages.clear();
+        mFonts.clear();
+        mTextureIndices.clear();
+        mImageIndices.clear();
+        mFontIndices.clear();
+        mHash = SFMLDiskCache::hash(NULL, 0);
+
+        for (std::size_t i = 0; i < mOwnedImages.size(); ++i)
+        {
+            delete mOwnedImages[i];
+        }
+
+        for (std::size_t i = 0; i < mOwnedTextures.size(); ++i)
+        {
+            delete mOwnedTextures[i];
+        }
+
+        for (std::size_t i = 0; i < mOwnedFonts.size(); ++i)
+        {
+            delete mOwnedFonts[i];
+        }
+
+        mOwnedImages.clear();
+        mOwnedTextures.clear();
+        mOwnedFonts.clear();
+    }
+
+    void SFMLCommandList::pushClipArea(const Rectangle& area)
+    {
+        Command command = makeCommand(PushClipArea);
+        command.x = area.x;
+        command.y = area.y;
+        command.width = area.width;
+        command.height = area.height;
+
+        add(command);
+    }
+
+    void SFMLCommandList::popClipArea()
+    {
+        add(makeCommand(PopClipArea));
+    }
+
+    void SFMLCommandList::fillRectangle(const Rectangle& rectangle, const Color& color)
+    {
+        Command command = makeCommand(FillRectangle);
+        command.x = rectangle.x;
+        command.y = rectangle.y;
+        command.width = rectangle.width;
+        command.height = rectangle.height;
+        command.color = packColor(color);
+
+        add(command);
+    }
+
+    void SFMLCommandList::drawRectangle(const Rectangle& rectangle, const Color& color)
+    {
+        Command command = makeCommand(DrawRectangle);
+        command.x = rectangle.x;
+        command.y = rectangle.y;
+        command.width = rectangle.width;
+        command.height = rectangle.height;
+        command.color = packColor(color);
+
+        add(command);
+    }
+
+    void SFMLCommandList::drawLine(int x1, int y1, int x2, int y2, const Color& color)
+    {
+        Command command = makeCommand(DrawLine);
+        command.x = x1;
+        command.y = y1;
+        command.width = x2;
+        command.height = y2;
+        command.color = packColor(color);
+
+        add(command);
+    }
+
+    void SFMLCommandList::drawPoint(int x, int y, const Color& color)
+    {
+        Command command = makeCommand(DrawPoint);
+        command.x = x;
+        command.y = y;
+        command.color = packColor(color);
+
+        add(command);
+    }
+
+    void SFMLCommandList::drawImage(const Image* image, int srcX, int srcY, int dstX, int dstY, int width, int height)
+    {
+        Command command = makeCommand(DrawImage);
+        command.x = dstX;
+        command.y = dstY;
+        command.width = width;
+        command.height = height;
+        command.srcX = srcX;
+        command.srcY = srcY;
+        command.resource = getIndex(mImages, mImageIndices, image);
+
+        add(command);
+    }
+
+    void SFMLCommandList::drawText(Font* font, const std::string& text, int x, int y)
+    {
+        const SFMLFont* sfmlFont = dynamic_cast<const SFMLFont*>(font);
+
+        Command command = makeCommand(DrawText);
+        command.x = x;
+        command.y = y;
+        command.color = sfmlFont != NULL ? packColor(sfmlFont->getColor()) : 0xffffffff;
+        command.resource = getIndex(mFonts, mFontIndices, font);
+        command.first = static_cast<sf::Uint32>(mStrings.size());
+
+        mStrings.push_back(text);
+        mHash = SFMLDiskCache::hash(text.data(), text.size(), mHash);
+
+        add(command);
+    }
+
+    void SFMLCommandList::drawTexturedQuads(const sf::Vertex* vertices,
+                                            std::size_t vertexCount,
+                                            const sf::Texture* texture,
+                                            const sf::Vector2f& offset)
+    {
+        Command command = makeCommand(DrawTexturedQuads);
+        command.resource = getIndex(mTextures, mTextureIndices, texture);
+        command.first = static_cast<sf::Uint32>(mVertices.size());
+        command.count = static_cast<sf::Uint32>(vertexCount);
+
+        for (std::size_t i = 0; i < vertexCount; ++i)
+        {
+            sf::Vertex vertex = vertices[i];
+            vertex.position += offset;
+            mVertices.push_back(vertex);
+        }
+
+        if (vertexCount > 0)
+        {
+            mHash = SFMLDiskCache::hash(&mVertices[command.first], vertexCount * sizeof(sf::Vertex), mHash);
+        }
+
+        add(command);
+    }
+
+    void SFMLCommandList::setBlendMode(const sf::BlendMode& blendMode)
+    {
+        Command command = makeCommand(SetBlendMode);
+
+        // Programs use a handful of blend modes, so a linear search will do.
+        command.resource = static_cast<sf::Uint32>(std::find(mBlendModes.begin(), mBlendModes.end(), blendMode)
+                                                   - mBlendModes.begin());
+
+        if (command.resource == mBlendModes.size())
+        {
+            const sf::Uint32 factors[6] =
+            {
+                static_cast<sf::Uint32>(blendMode.colorSrcFactor),
+                static_cast<sf::Uint32>(blendMode.colorDstFactor),
+                static_cast<sf::Uint32>(blendMode.colorEquation),
+                static_cast<sf::Uint32>(blendMode.alphaSrcFactor),
+                static_cast<sf::Uint32>(blendMode.alphaDstFactor),
+                static_cast<sf::Uint32>(blendMode.alphaEquation)
+            };
+
+            mBlendModes.push_back(blendMode);
+            mHash = SFMLDiskCache::hash(factors, sizeof(factors), mHash);
+        }
+
+        add(command);
+    }
+
+    sf::Uint64 SFMLCommandList::getHash() const
+    {
+        return mHash;
+    }
+
+    bool SFMLCommandList::hasSameCommands(const SFMLCommandList& other) const
+    {
+        return mHash == other.mHash
+               && mCommands.size() == other.mCommands.size()
+               && mVertices.size() == other.mVertices.size()
+               && mStrings.size() == other.mStrings.size();
+    }
+
+    bool SFMLCommandList::getChangedArea(const SFMLCommandList& previous, const Rectangle& root, Rectangle& area) const
+    {
+        std::vector<DrawnCommand> drawn;
+        std::vector<DrawnCommand> previousDrawn;
+
+        area = Rectangle(0, 0, 0, 0);
+
+        if (!getDrawnCommands(*this, root, drawn) || !getDrawnCommands(previous, root, previousDrawn))
+        {
+            return false;
+        }
+
+        // A changed widget usually leaves the commands before and after its
+        // own alone, so only the middle of the lists differs.
+        std::size_t first = 0;
+
+        while (first < drawn.size()
+               && first < previousDrawn.size()
+               && drawSame(*this, drawn[first], previous, previousDrawn[first]))
+        {
+            first++;
+        }
+
+        std::size_t end = drawn.size();
+        std::size_t previousEnd = previousDrawn.size();
+
+        while (end > first
+               && previousEnd > first
+               && drawSame(*this, drawn[end - 1], previous, previousDrawn[previousEnd - 1]))
+        {
+            end--;
+            previousEnd--;
+        }
+
+        for (std::size_t i = first; i < end; ++i)
+        {
+            unite(area, drawn[i].bounds);
+        }
+
+        for (std::size_t i = first; i < previousEnd; ++i)
+        {
+            unite(area, previousDrawn[i].bounds);
+        }
+
+        return true;
+    }
+
+    const std::vector<SFMLCommandList::Command>& SFMLCommandList::getCommands() const
+    {
+        return mCommands;
+    }
+
+    const std::vector<sf::Vertex>& SFMLCommandList::getVertices() const
+    {
+        return mVertices;
+    }
+
+    const std::string& SFMLCommandList::getString(sf::Uint32 index) const
+    {
+        return mStrings[index];
+    }
+
+    const Image* SFMLCommandList::getImage(sf::Uint32 index) const
+    {
+        return mImages[index];
+    }
+
+    Font* SFMLCommandList::getFont(sf::Uint32 index) const
+    {
+        return mFonts[index];
+    }
+
+    const sf::Texture* SFMLCommandList::getTexture(sf::Uint32 index) const
+    {
+        return mTextures[index];
+    }
+
+    const sf::BlendMode& SFMLCommandList::getBlendMode(sf::Uint32 index) const
+    {
+        return mBlendModes[index];
+    }
+
+    bool SFMLCommandList::saveToFile(const std::string& filename) const
+    {
+        std::vector<sf::Uint8> buffer;
+        Writer writer(buffer);
+
+        writer.writeUint32(MAGIC);
+        writer.writeUint32(VERSION);
+        writer.writeUint32(static_cast<sf::Uint32>(mCommands.size()));
+        writer.writeUint32(static_cast<sf::Uint32>(mStrings.size()));
+        writer.writeUint32(static_cast<sf::Uint32>(mVertices.size()));
+        writer.writeUint32(static_cast<sf::Uint32>(mBlendModes.size()));
+        writer.writeUint32(static_cast<sf::Uint32>(mTextures.size()));
+        writer.writeUint32(static_cast<sf::Uint32>(mImages.size()));
+        writer.writeUint32(static_cast<sf::Uint32>(mFonts.size()));
+
+        for (std::size_t i = 0; i < mCommands.size(); ++i)
+        {
+            const Command& command = mCommands[i];
+
+            writer.writeUint32(command.type);
+            writer.writeUint32(static_cast<sf::Uint32>(command.x));
+            writer.writeUint32(static_cast<sf::Uint32>(command.y));
+            writer.writeUint32(static_cast<sf::Uint32>(command.width));
+            writer.writeUint32(static_cast<sf::Uint32>(command.height));
+            writer.writeUint32(static_cast<sf::Uint32>(command.srcX));
+            writer.writeUint32(static_cast<sf::Uint32>(command.srcY));
+            writer.writeUint32(command.color);
+            writer.writeUint32(command.resource);
+            writer.writeUint32(command.first);
+            writer.writeUint32(command.count);
+        }
+
+        for (std::size_t i = 0; i < mStrings.size(); ++i)
+        {
+            writer.writeString(mStrings[i]);
+        }
+
+        for (std::size_t i = 0; i < mVertices.size(); ++i)
+        {
+            const sf::Vertex& vertex = mVertices[i];
+
+            writer.writeFloat(vertex.position.x);
+            writer.writeFloat(vertex.position.y);
+            writer.writeUint32(packColor(vertex.color));
+            writer.writeFloat(vertex.texCoords.x);
+            writer.writeFloat(vertex.texCoords.y);
+        }
+
+        for (std::size_t i = 0; i < mBlendModes.size(); ++i)
+        {
+            const sf::BlendMode& blendMode = mBlendModes[i];
+
+            writer.writeUint32(blendMode.colorSrcFactor);
+            writer.writeUint32(blendMode.colorDstFactor);
+            writer.writeUint32(blendMode.colorEquation);
+            writer.writeUint32(blendMode.alphaSrcFactor);
+            writer.writeUint32(blendMode.alphaDstFactor);
+            writer.writeUint32(blendMode.alphaEquation);
+        }
+
+        for (std::size_t i = 0; i < mTextures.size(); ++i)
+        {
+            writer.writePixels(mTextures[i]->copyToImage());
+        }
+
+        for (std::size_t i = 0; i < mImages.size(); ++i)
+        {
+            // Only the part of a shared texture the image occupies.
+            const SFMLImage* image = static_cast<const SFMLImage*>(mImages[i]);
+            const sf::IntRect& rect = image->getTextureRect();
+
+            sf::Image pixels;
+            pixels.create(rect.width, rect.height);
+            pixels.copy(image->getTexture()->copyToImage(), 0, 0, rect);
+
+            writer.writePixels(pixels);
+        }
+
+        for (std::size_t i = 0; i < mFonts.size(); ++i)
+        {
+            const SFMLFont* font = dynamic_cast<const SFMLFont*>(mFonts[i]);
+
+            writer.writeString(font != NULL ? font->getFilename() : std::string());
+            writer.writeUint32(font != NULL ? font->getHeight() : 0);
+        }
+
+        std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+        file.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size());
+
+        return !file.fail();
+    }
+
+    bool SFMLCommandList::loadFromFile(const std::string& filename)
+    {
+        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+
+        if (!file)
+        {
+            return false;
+        }
+
+        const std::vector<sf::Uint8> buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        Reader reader(buffer);
+
+        if (reader.readUint32() != MAGIC || reader.readUint32() != VERSION)
+        {
+            return false;
+        }
+
+        clear();
+
+        const sf::Uint32 commandCount = reader.readUint32();
+        const sf::Uint32 stringCount = reader.readUint32();
+        const sf::Uint32 vertexCount = reader.readUint32();
+        const sf::Uint32 blendModeCount = reader.readUint32();
+        const sf::Uint32 textureCount = reader.readUint32();
+        const sf::Uint32 imageCount = reader.readUint32();
+        const sf::Uint32 fontCount = reader.readUint32();
+
+        for (sf::Uint32 i = 0; i < commandCount && !reader.hasFailed(); ++i)
+        {
+            Command command;
+            command.type = reader.readUint32();
+            command.x = static_cast<sf::Int32>(reader.readUint32());
+            command.y = static_cast<sf::Int32>(reader.readUint32());
+            command.width = static_cast<sf::Int32>(reader.readUint32());
+            command.height = static_cast<sf::Int32>(reader.readUint32());
+            command.srcX = static_cast<sf::Int32>(reader.readUint32());
+            command.srcY = static_cast<sf::Int32>(reader.readUint32());
+            command.color = reader.readUint32();
+            command.resource = reader.readUint32();
+            command.first = reader.readUint32();
+            command.count = reader.readUint32();
+
+            mCommands.push_back(command);
+        }
+
+        for (sf::Uint32 i = 0; i < stringCount && !reader.hasFailed(); ++i)
+        {
+            mStrings.push_back(reader.readString());
+        }
+
+        for (sf::Uint32 i = 0; i < vertexCount && !reader.hasFailed(); ++i)
+        {
+            sf::Vertex vertex;
+            vertex.position.x = reader.readFloat();
+            vertex.position.y = reader.readFloat();
+
+            const sf::Uint32 color = reader.readUint32();
+            vertex.color = sf::Color(color >> 24, (color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff);
+
+            vertex.texCoords.x = reader.readFloat();
+            vertex.texCoords.y = reader.readFloat();
+
+            mVertices.push_back(vertex);
+        }
+
+        for (sf::Uint32 i = 0; i < blendModeCount && !reader.hasFailed(); ++i)
+        {
+            sf::BlendMode blendMode;
+            blendMode.colorSrcFactor = static_cast<sf::BlendMode::Factor>(reader.readUint32());
+            blendMode.colorDstFactor = static_cast<sf::BlendMode::Factor>(reader.readUint32());
+            blendMode.colorEquation = static_cast<sf::BlendMode::Equation>(reader.readUint32());
+            blendMode.alphaSrcFactor = static_cast<sf::BlendMode::Factor>(reader.readUint32());
+            blendMode.alphaDstFactor = static_cast<sf::BlendMode::Factor>(reader.readUint32());
+            blendMode.alphaEquation = static_cast<sf::BlendMode::Equation>(reader.readUint32());
+
+            mBlendModes.push_back(blendMode);
+        }
+
+        for (sf::Uint32 i = 0; i < textureCount && !reader.hasFailed(); ++i)
+        {
+            sf::Image pixels;
+            sf::Texture* texture = new sf::Texture();
+            mOwnedTextures.push_back(texture);
+
+            if (reader.readPixels(pixels))
+            {
+                texture->loadFromImage(pixels);
+            }
+
+            mTextures.push_back(texture);
+        }
+
+        for (sf::Uint32 i = 0; i < imageCount && !reader.hasFailed(); ++i)
+        {
+            sf::Image pixels;
+            sf::Texture* texture = new sf::Texture();
+
+            if (reader.readPixels(pixels))
+            {
+                texture->loadFromImage(pixels);
+            }
+
+            SFMLImage* image = new SFMLImage(texture, true);
+            mOwnedImages.push_back(image);
+            mImages.push_back(image);
+        }
+
+        for (sf::Uint32 i = 0; i < fontCount && !reader.hasFailed(); ++i)
+        {
+            const std::string fontFilename = reader.readString();
+            const sf::Uint32 characterSize = reader.readUint32();
+            SFMLFont* font = NULL;
+
+            if (!fontFilename.empty() && characterSize > 0)
+            {
+                try
+                {
+                    font = new SFMLFont(fontFilename, characterSize);
+                    mOwnedFonts.push_back(font);
+                }
+                catch (const Exception&)
+                {
+                    font = NULL;
+                }
+            }
+
+            mFonts.push_back(font);
+        }
+
+        if (reader.hasFailed())
+        {
+            clear();
+            return false;
+        }
+
+        // Commands referring past the end of the sections would crash
+        // SFMLGraphics::drawCommandList().
+        for (std::size_t i = 0; i < mCommands.size(); ++i)
+        {
+            const Command& command = mCommands[i];
+            bool valid = command.type <= SetBlendMode;
+
+            switch (command.type)
+            {
+                case DrawImage:
+                    valid = command.resource < mImages.size();
+                    break;
+                case DrawText:
+                    valid = command.resource < mFonts.size() && command.first < mStrings.size();
+                    break;
+                case DrawTexturedQuads:
+                    valid = command.resource < mTextures.size()
+                            && command.first <= mVertices.size()
+                            && command.count <= mVertices.size() - command.first;
+                    break;
+                case SetBlendMode:
+                    valid = command.resource < mBlendModes.size();
+                    break;
+                default:
+                    break;
+            }
+
+            if (!valid)
+            {
+                clear();
+                return false;
+            }
+        }
+
+        // The hash of a loaded list only has to be stable between loads.
+        if (!mCommands.empty())
+        {
+            mHash = SFMLDiskCache::hash(&buffer[0], buffer.size());
+        }
+
+        return true;
+    }
+
+    void SFMLCommandList::add(const Command& command)
+    {
+        mCommands.push_back(command);
+        mHash = SFMLDiskCache::hash(&command, sizeof(command), mHash);
+    }
+
+    template <typename T>
+    sf::Uint32 SFMLCommandList::getIndex(std::vector<T*>& resources,
+                                         std::map<const void*, sf::Uint32>& indices,
+                                         T* resource)
+    {
+        std::map<const void*, sf::Uint32>::iterator it = indices.find(resource);
+
+        if (it != indices.end())
+        {
+            return it->second;
+        }
+
+        // The identity of the resource is part of what is drawn.
+        const sf::Uint32 index = static_cast<sf::Uint32>(resources.size());
+        mHash = SFMLDiskCache::hash(&resource, sizeof(resource), mHash);
+
+        resources.push_back(resource);
+        indices[resource] = index;
+
+        return index;
+    }
+}
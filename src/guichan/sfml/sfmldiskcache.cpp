@@ -0,0 +1,357 @@
+#include "guichan/sfml/sfmldiskcache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include <SFML/Graphics/Image.hpp>
+#include <SFML/System/Lock.hpp>
+
+#include "guichan/sfml/sfmlassetpack.hpp"
+#include "guichan/sfml/sfmlimageloader.hpp"
+#include "guichan/sfml/sfmlmappedfile.hpp"
+
+namespace
+{
+    const char* const ENTRY_EXTENSION = ".gcnimg";
+
+    /**
+     * A file in the cache directory.
+     */
+    struct DirectoryEntry
+    {
+        std::string path;
+        std::size_t size;
+        time_t lastUse;
+
+        bool operator<(const DirectoryEntry& other) const
+        {
+            return lastUse < other.lastUse;
+        }
+    };
+
+    /**
+     * Lists the entries of a cache directory.
+     */
+    void listEntries(const std::string& directory, std::vector<DirectoryEntry>& entries)
+    {
+        std::vector<std::string> names;
+
+#ifdef _WIN32
+        WIN32_FIND_DATAA data;
+        HANDLE find = FindFirstFileA((directory + "/*" + ENTRY_EXTENSION).c_str(), &data);
+
+        if (find != INVALID_HANDLE_VALUE)
+        {
+            do
+            {
+                names.push_back(data.cFileName);
+            }
+            while (FindNextFileA(find, &data));
+
+            FindClose(find);
+        }
+#else
+        DIR* dir = opendir(directory.c_str());
+
+        if (dir != NULL)
+        {
+            const std::string extension(ENTRY_EXTENSION);
+
+            while (struct dirent* entry = readdir(dir))
+            {
+                const std::string name(entry->d_name);
+
+                if (name.size() > extension.size()
+                    && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+                {
+                    names.push_back(name);
+                }
+            }
+
+            closedir(dir);
+        }
+#endif
+
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            DirectoryEntry entry;
+            entry.path = directory + "/" + names[i];
+
+            struct stat status;
+
+            if (stat(entry.path.c_str(), &status) == 0)
+            {
+                entry.size = static_cast<std::size_t>(status.st_size);
+                entry.lastUse = status.st_mtime;
+                entries.push_back(entry);
+            }
+        }
+    }
+
+    void writeUint64(sf::Uint8* data, sf::Uint64 value)
+    {
+        gcn::SFMLAssetPack::writeUint32(data, static_cast<sf::Uint32>(value));
+        gcn::SFMLAssetPack::writeUint32(data + 4, static_cast<sf::Uint32>(value >> 32));
+    }
+
+    sf::Uint64 readUint64(const sf::Uint8* data)
+    {
+        return static_cast<sf::Uint64>(gcn::SFMLAssetPack::readUint32(data))
+               | (static_cast<sf::Uint64>(gcn::SFMLAssetPack::readUint32(data + 4)) << 32);
+    }
+}
+
+namespace gcn
+{
+    SFMLDiskCache::SFMLDiskCache(const std::string& directory, std::size_t maxBytes)
+        : mDirectory(directory),
+          mMaxBytes(maxBytes),
+          mTotalBytes(0),
+          mHits(0),
+          mMisses(0),
+          mTemporaryCount(0)
+    {
+#ifdef _WIN32
+        _mkdir(mDirectory.c_str());
+#else
+        mkdir(mDirectory.c_str(), 0755);
+#endif
+
+        prune();
+    }
+
+    bool SFMLDiskCache::load(const std::string& filename, sf::Image& image)
+    {
+        sf::Uint64 key = 0;
+        bool loaded = false;
+
+        if (getKey(filename, key))
+        {
+            const std::string path = getEntryPath(key);
+            SFMLMappedFile file;
+
+            if (file.open(path) && file.getSize() >= HEADER_SIZE)
+            {
+                const sf::Uint8* data = static_cast<const sf::Uint8*>(file.getData());
+                const sf::Uint64 width = SFMLAssetPack::readUint32(data + 16);
+                const sf::Uint64 height = SFMLAssetPack::readUint32(data + 20);
+                const sf::Uint64 pixelBytes = width * height * 4;
+
+                // A file with the right name may still be damaged, or a
+                // hash collision.
+                if (SFMLAssetPack::readUint32(data) == MAGIC
+                    && SFMLAssetPack::readUint32(data + 4) == VERSION
+                    && readUint64(data + 8) == key
+                    && file.getSize() - HEADER_SIZE == pixelBytes
+                    && readUint64(data + 24) == hash(data + HEADER_SIZE, static_cast<std::size_t>(pixelBytes)))
+                {
+                    image.create(static_cast<unsigned int>(width),
+                                 static_cast<unsigned int>(height),
+                                 data + HEADER_SIZE);
+                    loaded = true;
+                }
+            }
+
+            // Marks the entry as recently used for prune().
+            if (loaded)
+            {
+                utime(path.c_str(), NULL);
+            }
+        }
+
+        sf::Lock lock(mMutex);
+
+        if (loaded)
+        {
+            mHits++;
+        }
+        else
+        {
+            mMisses++;
+        }
+
+        return loaded;
+    }
+
+    void SFMLDiskCache::store(const std::string& filename, const sf::Image& image)
+    {
+        sf::Uint64 key = 0;
+
+        if (!getKey(filename, key))
+        {
+            return;
+        }
+
+        const sf::Vector2u size = image.getSize();
+        const std::size_t pixelBytes = static_cast<std::size_t>(size.x) * size.y * 4;
+
+        sf::Uint8 header[HEADER_SIZE];
+        SFMLAssetPack::writeUint32(header, MAGIC);
+        SFMLAssetPack::writeUint32(header + 4, VERSION);
+        writeUint64(header + 8, key);
+        SFMLAssetPack::writeUint32(header + 16, size.x);
+        SFMLAssetPack::writeUint32(header + 20, size.y);
+        writeUint64(header + 24, hash(image.getPixelsPtr(), pixelBytes));
+
+        std::ostringstream temporary;
+
+        {
+            sf::Lock lock(mMutex);
+
+#ifdef _WIN32
+            temporary << getEntryPath(key) << "." << GetCurrentProcessId() << "." << mTemporaryCount++ << ".tmp";
+#else
+            temporary << getEntryPath(key) << "." << getpid() << "." << mTemporaryCount++ << ".tmp";
+#endif
+        }
+
+        // Written under a temporary name and renamed, so other threads and
+        // processes never see a partial entry.
+        {
+            std::ofstream file(temporary.str().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+            file.write(reinterpret_cast<const char*>(header), HEADER_SIZE);
+
+            if (pixelBytes > 0)
+            {
+                file.write(reinterpret_cast<const char*>(image.getPixelsPtr()), pixelBytes);
+            }
+
+            if (!file)
+            {
+                file.close();
+                std::remove(temporary.str().c_str());
+                return;
+            }
+        }
+
+        if (std::rename(temporary.str().c_str(), getEntryPath(key).c_str()) != 0)
+        {
+            std::remove(temporary.str().c_str());
+            return;
+        }
+
+        bool needsPruning = false;
+
+        {
+            sf::Lock lock(mMutex);
+            mTotalBytes += HEADER_SIZE + pixelBytes;
+            needsPruning = mTotalBytes > mMaxBytes;
+        }
+
+        if (needsPruning)
+        {
+            prune();
+        }
+    }
+
+    void SFMLDiskCache::prune()
+    {
+        sf::Lock lock(mMutex);
+
+        std::vector<DirectoryEntry> entries;
+        listEntries(mDirectory, entries);
+
+        std::size_t totalBytes = 0;
+
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            totalBytes += entries[i].size;
+        }
+
+        std::sort(entries.begin(), entries.end());
+
+        for (std::size_t i = 0; i < entries.size() && totalBytes > mMaxBytes; ++i)
+        {
+            if (std::remove(entries[i].path.c_str()) == 0)
+            {
+                totalBytes -= entries[i].size;
+            }
+        }
+
+        mTotalBytes = totalBytes;
+    }
+
+    const std::string& SFMLDiskCache::getDirectory() const
+    {
+        return mDirectory;
+    }
+
+    unsigned int SFMLDiskCache::getHits() const
+    {
+        sf::Lock lock(mMutex);
+
+        return mHits;
+    }
+
+    unsigned int SFMLDiskCache::getMisses() const
+    {
+        sf::Lock lock(mMutex);
+
+        return mMisses;
+    }
+
+    sf::Uint64 SFMLDiskCache::hash(const void* data, std::size_t size, sf::Uint64 hash)
+    {
+        const sf::Uint8* bytes = static_cast<const sf::Uint8*>(data);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
+    }
+
+    bool SFMLDiskCache::getKey(const std::string& filename, sf::Uint64& key) const
+    {
+        struct stat status;
+
+        if (stat(filename.c_str(), &status) != 0)
+        {
+            return false;
+        }
+
+        const std::string path = SFMLImageLoader::normalizePath(filename);
+
+        sf::Uint8 attributes[16];
+        writeUint64(attributes, static_cast<sf::Uint64>(status.st_size));
+        writeUint64(attributes + 8, static_cast<sf::Uint64>(status.st_mtime));
+
+        key = hash(path.data(), path.size());
+        key = hash(attributes, sizeof(attributes), key);
+
+        return true;
+    }
+
+    std::string SFMLDiskCache::getEntryPath(sf::Uint64 key) const
+    {
+        char name[17];
+        std::sprintf(name, "%08x%08x",
+                     static_cast<unsigned int>(key >> 32),
+                     static_cast<unsigned int>(key & 0xffffffff));
+
+        return mDirectory + "/" + name + ENTRY_EXTENSION;
+    }
+}
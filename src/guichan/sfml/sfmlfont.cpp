@@ -1,10 +1,17 @@
 #include "guichan/sfml/sfmlfont.hpp"
+
 #include "guichan/sfml/sfmlgraphics.hpp"
+#include "guichan/sfml/sfmltrace.hpp"
 
+#include <algorithm>
 #include <limits>
 #include <string>
 
 #include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <SFML/System/Clock.hpp>
+#include <SFML/System/Lock.hpp>
+#include <SFML/System/String.hpp>
 
 #include "guichan/exception.hpp"
 #include "guichan/graphics.hpp"
@@ -13,15 +20,62 @@
 namespace gcn
 {
     SFMLFont::SFMLFont(const std::string& filename, unsigned int size)
+        : mWidthCacheSize(256),
+          mWidthCacheHits(0),
+          mWidthCacheMisses(0),
+          mPrefixCharacterSize(0),
+          mGeometryCacheSize(1024),
+          mGeometryCacheHits(0),
+          mGeometryCacheMisses(0),
+          mRegistry(&SFMLFontRegistry::getDefault()),
+          mFace(NULL),
+          mFilename(filename)
     {
-        if (!mFont.loadFromFile(filename))
-        {
-            throw GCN_EXCEPTION("Unable to load font from file \"" + filename + "\"");
-        }
+        mFace = mRegistry->acquire(filename, size);
+        init(size);
+    }
+
+    SFMLFont::SFMLFont(SFMLFontRegistry& registry, const std::string& filename, unsigned int size)
+        : mWidthCacheSize(256),
+          mWidthCacheHits(0),
+          mWidthCacheMisses(0),
+          mPrefixCharacterSize(0),
+          mGeometryCacheSize(1024),
+          mGeometryCacheHits(0),
+          mGeometryCacheMisses(0),
+          mRegistry(&registry),
+          mFace(NULL),
+          mFilename(filename)
+    {
+        mFace = mRegistry->acquire(filename, size);
+        init(size);
+    }
+
+    SFMLFont::SFMLFont(const void* data, std::size_t dataSize, unsigned int size)
+        : mWidthCacheSize(256),
+          mWidthCacheHits(0),
+          mWidthCacheMisses(0),
+          mPrefixCharacterSize(0),
+          mGeometryCacheSize(1024),
+          mGeometryCacheHits(0),
+          mGeometryCacheMisses(0),
+          mRegistry(&SFMLFontRegistry::getDefault()),
+          mFace(NULL)
+    {
+        mFace = mRegistry->acquire(data, dataSize, size);
+        init(size);
+    }
+
+    SFMLFont::~SFMLFont()
+    {
+        mRegistry->release(mFace, mText.getCharacterSize());
+    }
 
+    void SFMLFont::init(unsigned int size)
+    {
         mColor = sf::Color::White;
 
-        mText.setFont(mFont);
+        mText.setFont(mFace->font);
         mText.setCharacterSize(size);
         mText.setStyle(sf::Text::Regular);
     }
@@ -39,7 +93,12 @@ namespace gcn
 
     const sf::Font& SFMLFont::getFont() const
     {
-        return mFont;
+        return mFace->font;
+    }
+
+    const std::string& SFMLFont::getFilename() const
+    {
+        return mFilename;
     }
 
     int SFMLFont::getHeight() const
@@ -47,17 +106,160 @@ namespace gcn
         return mText.getCharacterSize();
     }
 
+    void SFMLFont::setWidthCacheSize(std::size_t size)
+    {
+        mWidthCacheSize = size;
+
+        while (mWidthList.size() > mWidthCacheSize)
+        {
+            mWidthCache.erase(mWidthList.back().first);
+            mWidthList.pop_back();
+        }
+    }
+
+    unsigned int SFMLFont::getWidthCacheHits() const
+    {
+        return mWidthCacheHits;
+    }
+
+    unsigned int SFMLFont::getWidthCacheMisses() const
+    {
+        return mWidthCacheMisses;
+    }
+
+    sf::Time SFMLFont::getMeasureTime() const
+    {
+        return mMeasureTime;
+    }
+
     int SFMLFont::getWidth(const std::string& text) const
     {
-        sf::Text measureText(text, mFont, mText.getCharacterSize());
-        sf::Vector2f renderedDimensions = measureText.findCharacterPos(text.size());
+        sf::Lock lock(mFace->mutex);
+
+        std::map<std::string, WidthList::iterator>::iterator cached = mWidthCache.find(text);
+
+        if (cached != mWidthCache.end())
+        {
+            mWidthCacheHits++;
+            mWidthList.splice(mWidthList.begin(), mWidthList, cached->second);
+
+            return cached->second->second;
+        }
+
+        mWidthCacheMisses++;
+
+        sf::Clock clock;
+        const int width = static_cast<int>(measure(text));
+        mMeasureTime += clock.getElapsedTime();
+
+        if (mWidthCacheSize > 0)
+        {
+            if (mWidthList.size() >= mWidthCacheSize)
+            {
+                mWidthCache.erase(mWidthList.back().first);
+                mWidthList.pop_back();
+            }
+
+            mWidthList.push_front(std::make_pair(text, width));
+            mWidthCache[text] = mWidthList.begin();
+        }
 
-        return static_cast<int>(renderedDimensions.x);
+        return width;
+    }
+
+    float SFMLFont::measure(const std::string& text) const
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLFont::measure");
+
+        // Mirrors sf::Text::findCharacterPos() for the regular style.
+        AdvanceTable& table = getAdvanceTable();
+
+        float x = 0.0f;
+
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+            const unsigned char current = static_cast<unsigned char>(text[i]);
+
+            if (i > 0)
+            {
+                x += getKerning(table, static_cast<unsigned char>(text[i - 1]), current);
+            }
+
+            if (current == '\n')
+            {
+                x = 0.0f;
+                continue;
+            }
+
+            x += table.advances[current];
+        }
+
+        return x;
+    }
+
+    SFMLFont::AdvanceTable& SFMLFont::getAdvanceTable() const
+    {
+        const unsigned int characterSize = mText.getCharacterSize();
+
+        std::map<unsigned int, AdvanceTable>::iterator it = mFace->advanceTables.find(characterSize);
+
+        if (it != mFace->advanceTables.end())
+        {
+            return it->second;
+        }
+
+        AdvanceTable& table = mFace->advanceTables[characterSize];
+
+        for (unsigned int i = 0; i < 256; ++i)
+        {
+            // Convert each byte the same way sf::Text converts a std::string.
+            const sf::String converted(std::string(1, static_cast<char>(i)));
+            table.codePoints[i] = converted.isEmpty() ? 0 : converted[0];
+            table.advances[i] = mFace->font.getGlyph(table.codePoints[i], characterSize, false).advance;
+        }
+
+        table.advances[static_cast<unsigned char>('\t')] = table.advances[static_cast<unsigned char>(' ')] * 4;
+        table.advances[static_cast<unsigned char>('\n')] = 0.0f;
+
+        return table;
+    }
+
+    float SFMLFont::getKerning(AdvanceTable& table, unsigned char first, unsigned char second) const
+    {
+        if (table.kerning.empty())
+        {
+            table.kerning.resize(256 * 256, 0.0f);
+            table.kerningKnown.resize(256 * 256, false);
+        }
+
+        const std::size_t index = first * 256 + second;
+
+        if (!table.kerningKnown[index])
+        {
+            table.kerning[index] = mFace->font.getKerning(table.codePoints[first],
+                                                          table.codePoints[second],
+                                                          mText.getCharacterSize());
+            table.kerningKnown[index] = true;
+        }
+
+        return table.kerning[index];
+    }
+
+    sf::FloatRect SFMLFont::getStringBounds(const std::string& text, const sf::Color& color)
+    {
+        sf::Lock lock(mFace->mutex);
+
+        return getTextGeometry(text, color).bounds;
     }
 
     void SFMLFont::drawString(Graphics* graphics, const std::string& text, int x, int y)
     {
-        const SFMLGraphics* sfmlGraphics = dynamic_cast<SFMLGraphics*>(graphics);
+        drawString(graphics, text, x, y, mColor);
+    }
+
+    void SFMLFont::drawString(Graphics* graphics, const std::string& text, int x, int y, const sf::Color& color)
+    {
+        SFMLGraphics* sfmlGraphics = dynamic_cast<SFMLGraphics*>(graphics);
         
         if (sfmlGraphics == NULL)
 	    {
@@ -69,21 +271,255 @@ namespace gcn
         x += clip.xOffset;
         y += clip.yOffset;
 
-        mText.setString(text);
-        mText.setPosition(static_cast<float>(x), static_cast<float>(y));
+        sf::Lock lock(mFace->mutex);
 
-        sf::RenderTarget& target = sfmlGraphics->getRenderTarget();
+        const TextGeometry& geometry = getTextGeometry(text, color);
 
-        target.draw(mText);
+        if (geometry.vertices.empty())
+        {
+            return;
+        }
+
+        // Strings scrolled out of view are skipped as a whole.
+        const float left = geometry.bounds.left + x;
+        const float top = geometry.bounds.top + y;
+
+        if (left >= clip.x + clip.width
+            || top >= clip.y + clip.height
+            || left + geometry.bounds.width <= clip.x
+            || top + geometry.bounds.height <= clip.y)
+        {
+            return;
+        }
+
+        // The glyphs go into the same batch as everything else, so a run of
+        // labels on the same glyph page costs a single draw call.
+        sfmlGraphics->drawTexturedQuads(&geometry.vertices[0],
+                                        geometry.vertices.size(),
+                                        &mFace->font.getTexture(mText.getCharacterSize()),
+                                        sf::Vector2f(static_cast<float>(x), static_cast<float>(y)));
+    }
+
+    void SFMLFont::setGeometryCacheSize(std::size_t size)
+    {
+        mGeometryCacheSize = size;
+
+        while (mGeometryList.size() > mGeometryCacheSize)
+        {
+            mGeometryCache.erase(mGeometryList.back().first);
+            mGeometryList.pop_back();
+        }
+    }
+
+    unsigned int SFMLFont::getGeometryCacheHits() const
+    {
+        return mGeometryCacheHits;
+    }
+
+    unsigned int SFMLFont::getGeometryCacheMisses() const
+    {
+        return mGeometryCacheMisses;
+    }
+
+    bool SFMLFont::TextGeometryKey::operator<(const TextGeometryKey& other) const
+    {
+        if (characterSize != other.characterSize)
+        {
+            return characterSize < other.characterSize;
+        }
+
+        if (style != other.style)
+        {
+            return style < other.style;
+        }
+
+        if (color != other.color)
+        {
+            return color < other.color;
+        }
+
+        return text < other.text;
+    }
+
+    const SFMLFont::TextGeometry& SFMLFont::getTextGeometry(const std::string& text, const sf::Color& color)
+    {
+        if (mGeometryCacheSize == 0)
+        {
+            mGeometryCacheMisses++;
+            buildTextGeometry(text, color, mUncachedGeometry);
+
+            return mUncachedGeometry;
+        }
+
+        TextGeometryKey key;
+        key.text = text;
+        key.characterSize = mText.getCharacterSize();
+        key.style = mText.getStyle();
+        key.color = (static_cast<sf::Uint32>(color.r) << 24)
+                    | (static_cast<sf::Uint32>(color.g) << 16)
+                    | (static_cast<sf::Uint32>(color.b) << 8)
+                    | static_cast<sf::Uint32>(color.a);
+
+        std::map<TextGeometryKey, GeometryList::iterator>::iterator cached = mGeometryCache.find(key);
+
+        if (cached != mGeometryCache.end())
+        {
+            mGeometryCacheHits++;
+            mGeometryList.splice(mGeometryList.begin(), mGeometryList, cached->second);
+
+            return cached->second->second;
+        }
+
+        mGeometryCacheMisses++;
+
+        if (mGeometryList.size() >= mGeometryCacheSize)
+        {
+            mGeometryCache.erase(mGeometryList.back().first);
+            mGeometryList.pop_back();
+        }
+
+        mGeometryList.push_front(std::make_pair(key, TextGeometry()));
+        mGeometryCache[key] = mGeometryList.begin();
+
+        TextGeometry& geometry = mGeometryList.front().second;
+        buildTextGeometry(text, color, geometry);
+
+        return geometry;
+    }
+
+    void SFMLFont::buildTextGeometry(const std::string& text, const sf::Color& color, TextGeometry& geometry) const
+    {
+        // Mirrors sf::Text::ensureGeometryUpdate() for the regular style.
+        AdvanceTable& table = getAdvanceTable();
+
+        const unsigned int characterSize = mText.getCharacterSize();
+        const float whitespace = table.advances[static_cast<unsigned char>(' ')];
+        const float lineSpacing = mFace->font.getLineSpacing(characterSize);
+
+        geometry.vertices.clear();
+        geometry.vertices.reserve(text.size() * 4);
+
+        float x = 0.0f;
+        float y = static_cast<float>(characterSize);
+
+        float minX = 0.0f;
+        float minY = 0.0f;
+        float maxX = 0.0f;
+        float maxY = 0.0f;
+
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+            const unsigned char current = static_cast<unsigned char>(text[i]);
+
+            if (i > 0)
+            {
+                x += getKerning(table, static_cast<unsigned char>(text[i - 1]), current);
+            }
+
+            switch (current)
+            {
+                case ' ':
+                    x += whitespace;
+                    continue;
+                case '\t':
+                    x += whitespace * 4;
+                    continue;
+                case '\n':
+                    y += lineSpacing;
+                    x = 0.0f;
+                    continue;
+                case '\v':
+                    y += lineSpacing * 4;
+                    continue;
+            }
+
+            const sf::Glyph& glyph = mFace->font.getGlyph(table.codePoints[current], characterSize, false);
+
+            const float left = x + glyph.bounds.left;
+            const float top = y + glyph.bounds.top;
+            const float right = left + glyph.bounds.width;
+            const float bottom = top + glyph.bounds.height;
+
+            const float u1 = static_cast<float>(glyph.textureRect.left);
+            const float v1 = static_cast<float>(glyph.textureRect.top);
+            const float u2 = static_cast<float>(glyph.textureRect.left + glyph.textureRect.width);
+            const float v2 = static_cast<float>(glyph.textureRect.top + glyph.textureRect.height);
+
+            geometry.vertices.push_back(sf::Vertex(sf::Vector2f(left, top), color, sf::Vector2f(u1, v1)));
+            geometry.vertices.push_back(sf::Vertex(sf::Vector2f(right, top), color, sf::Vector2f(u2, v1)));
+            geometry.vertices.push_back(sf::Vertex(sf::Vector2f(right, bottom), color, sf::Vector2f(u2, v2)));
+            geometry.vertices.push_back(sf::Vertex(sf::Vector2f(left, bottom), color, sf::Vector2f(u1, v2)));
+
+            if (geometry.vertices.size() == 4)
+            {
+                minX = left;
+                minY = top;
+                maxX = right;
+                maxY = bottom;
+            }
+            else
+            {
+                minX = std::min(minX, left);
+                minY = std::min(minY, top);
+                maxX = std::max(maxX, right);
+                maxY = std::max(maxY, bottom);
+            }
+
+            x += glyph.advance;
+        }
+
+        geometry.bounds = sf::FloatRect(minX, minY, maxX - minX, maxY - minY);
     }
 
     int SFMLFont::getStringIndexAt(const std::string& text, int x) const
     {
-        if (x > (int)text.size() * 8)
+        // Same result as gcn::Font: the first character whose right edge
+        // lies beyond x, or the length of the string if there is none.
+        sf::Lock lock(mFace->mutex);
+
+        const std::vector<float>& prefix = getPrefixAdvances(text);
+
+        std::vector<float>::const_iterator it = std::lower_bound(prefix.begin() + 1,
+                                                                 prefix.end(),
+                                                                 static_cast<float>(x) + 1.0f);
+
+        return static_cast<int>(it - (prefix.begin() + 1));
+    }
+
+    const std::vector<float>& SFMLFont::getPrefixAdvances(const std::string& text) const
+    {
+        if (!mPrefixAdvances.empty()
+            && mPrefixCharacterSize == mText.getCharacterSize()
+            && mPrefixText == text)
+        {
+            return mPrefixAdvances;
+        }
+
+        AdvanceTable& table = getAdvanceTable();
+
+        mPrefixText = text;
+        mPrefixCharacterSize = mText.getCharacterSize();
+        mPrefixAdvances.resize(text.size() + 1);
+        mPrefixAdvances[0] = 0.0f;
+
+        float x = 0.0f;
+
+        for (std::size_t i = 0; i < text.size(); ++i)
         {
-            return text.size();
+            const unsigned char current = static_cast<unsigned char>(text[i]);
+
+            if (i > 0)
+            {
+                x += getKerning(table, static_cast<unsigned char>(text[i - 1]), current);
+            }
+
+            x += table.advances[current];
+
+            // Negative kerning may pull a character back slightly; keep the
+            // positions sorted for the binary search.
+            mPrefixAdvances[i + 1] = std::max(x, mPrefixAdvances[i]);
         }
 
-        return x / 8;
+        return mPrefixAdvances;
     }
 }
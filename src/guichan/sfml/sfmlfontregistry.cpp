@@ -0,0 +1,192 @@
+#include "guichan/sfml/sfmlfontregistry.hpp"
+
+#include "guichan/sfml/sfmlimageloader.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#include <SFML/Graphics/Texture.hpp>
+
+#include "guichan/exception.hpp"
+
+namespace gcn
+{
+    SFMLFontRegistry::SFMLFontRegistry()
+        : mMemoryMappingEnabled(false)
+    {
+    }
+
+    SFMLFontRegistry::~SFMLFontRegistry()
+    {
+        for (FaceMap::iterator it = mFaces.begin(); it != mFaces.end(); ++it)
+        {
+            delete it->second;
+        }
+    }
+
+    SFMLFontRegistry& SFMLFontRegistry::getDefault()
+    {
+        // Constructed by the first font which needs it, so it is destroyed
+        // after every font constructed before the end of main().
+        static SFMLFontRegistry registry;
+
+        return registry;
+    }
+
+    SFMLFontRegistry::Face* SFMLFontRegistry::acquire(const std::string& filename, unsigned int characterSize)
+    {
+        const std::string key = SFMLImageLoader::normalizePath(filename);
+
+        FaceMap::iterator it = mFaces.find(key);
+
+        if (it != mFaces.end())
+        {
+            return reference(it->second, characterSize);
+        }
+
+        Face* face = new Face();
+        bool loaded = false;
+
+        if (mMemoryMappingEnabled)
+        {
+            loaded = face->mapping.open(filename)
+                     && face->font.loadFromMemory(face->mapping.getData(), face->mapping.getSize());
+            face->fileBytes = face->mapping.getSize();
+        }
+        else
+        {
+            loaded = face->font.loadFromFile(filename);
+
+            std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+            file.seekg(0, std::ios::end);
+            face->fileBytes = file ? static_cast<std::size_t>(file.tellg()) : 0;
+        }
+
+        if (!loaded)
+        {
+            delete face;
+            throw GCN_EXCEPTION("Unable to load font from file \"" + filename + "\"");
+        }
+
+        face->filename = key;
+        face->mapped = mMemoryMappingEnabled;
+        face->references = 0;
+        mFaces[key] = face;
+
+        return reference(face, characterSize);
+    }
+
+    SFMLFontRegistry::Face* SFMLFontRegistry::acquire(const void* data, std::size_t size, unsigned int characterSize)
+    {
+        std::ostringstream key;
+        key << "memory:" << data << ":" << size;
+
+        FaceMap::iterator it = mFaces.find(key.str());
+
+        if (it != mFaces.end())
+        {
+            return reference(it->second, characterSize);
+        }
+
+        Face* face = new Face();
+
+        if (!face->font.loadFromMemory(data, size))
+        {
+            delete face;
+            throw GCN_EXCEPTION("Unable to load font from memory");
+        }
+
+        face->filename = key.str();
+        face->fileBytes = size;
+        face->mapped = false;
+        face->references = 0;
+        mFaces[face->filename] = face;
+
+        return reference(face, characterSize);
+    }
+
+    void SFMLFontRegistry::setMemoryMappingEnabled(bool memoryMappingEnabled)
+    {
+        mMemoryMappingEnabled = memoryMappingEnabled;
+    }
+
+    bool SFMLFontRegistry::isMemoryMappingEnabled() const
+    {
+        return mMemoryMappingEnabled;
+    }
+
+    SFMLFontRegistry::Face* SFMLFontRegistry::reference(Face* face, unsigned int characterSize)
+    {
+        face->references++;
+        face->characterSizes[characterSize]++;
+
+        return face;
+    }
+
+    void SFMLFontRegistry::release(Face* face, unsigned int characterSize)
+    {
+        if (face == NULL)
+        {
+            return;
+        }
+
+        std::map<unsigned int, unsigned int>::iterator size = face->characterSizes.find(characterSize);
+
+        if (size != face->characterSizes.end() && --size->second == 0)
+        {
+            face->characterSizes.erase(size);
+        }
+
+        if (--face->references > 0)
+        {
+            return;
+        }
+
+        mFaces.erase(face->filename);
+        delete face;
+    }
+
+    std::size_t SFMLFontRegistry::getFaceCount() const
+    {
+        return mFaces.size();
+    }
+
+    std::vector<SFMLFontRegistry::FaceInfo> SFMLFontRegistry::getFaceInfo() const
+    {
+        std::vector<FaceInfo> faces;
+
+        for (FaceMap::const_iterator it = mFaces.begin(); it != mFaces.end(); ++it)
+        {
+            const Face* face = it->second;
+
+            FaceInfo info;
+            info.filename = face->filename;
+            info.references = face->references;
+            info.fileBytes = face->fileBytes;
+            info.mapped = face->mapped;
+            info.glyphPageBytes = 0;
+            info.metricsBytes = 0;
+
+            std::map<unsigned int, unsigned int>::const_iterator size;
+
+            for (size = face->characterSizes.begin(); size != face->characterSizes.end(); ++size)
+            {
+                const sf::Vector2u pageSize = face->font.getTexture(size->first).getSize();
+                info.glyphPageBytes += static_cast<std::size_t>(pageSize.x) * pageSize.y * 4;
+            }
+
+            std::map<unsigned int, AdvanceTable>::const_iterator table;
+
+            for (table = face->advanceTables.begin(); table != face->advanceTables.end(); ++table)
+            {
+                info.metricsBytes += sizeof(AdvanceTable)
+                                     + table->second.kerning.capacity() * sizeof(float)
+                                     + table->second.kerningKnown.capacity() / 8;
+            }
+
+            faces.push_back(info);
+        }
+
+        return faces;
+    }
+}
@@ -3,12 +3,64 @@
 #include "guichan/exception.hpp"
 #include "guichan/font.hpp"
 #include "guichan/image.hpp"
+#include "guichan/sfml/sfmlcommandlist.hpp"
+#include "guichan/sfml/sfmlfont.hpp"
 #include "guichan/sfml/sfmlimage.hpp"
+#include "guichan/sfml/sfmltrace.hpp"
 
 #include <SFML/Graphics.hpp>
 
+#include <algorithm>
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GCN_SFML_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GCN_SFML_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef GCN_SFML_ENABLE_STATISTICS
+namespace
+{
+    /**
+     * Adds the time until it goes out of scope to the CPU time of a frame.
+     * Only the outermost of nested timers counts, so backend calls making
+     * other backend calls aren't counted twice.
+     */
+    class BackendTimer
+    {
+    public:
+        BackendTimer(float& cpuTime, unsigned int& depth)
+            : mCpuTime(cpuTime),
+              mDepth(depth)
+        {
+            mDepth++;
+        }
+
+        ~BackendTimer()
+        {
+            if (--mDepth == 0)
+            {
+                mCpuTime += mClock.getElapsedTime().asSeconds() * 1000.0f;
+            }
+        }
+
+    private:
+        float& mCpuTime;
+        unsigned int& mDepth;
+        sf::Clock mClock;
+    };
+}
+
+#define GCN_SFML_COUNT(counter, amount) (mFrameStatistics.counter += (amount))
+#define GCN_SFML_TIME_BACKEND() BackendTimer backendTimer(mFrameStatistics.cpuTime, mBackendTimerDepth)
+#else
+#define GCN_SFML_COUNT(counter, amount) ((void)0)
+#define GCN_SFML_TIME_BACKEND() ((void)0)
+#endif
+
 namespace gcn
 {
     const float SFMLGraphics::PIXEL_ALIGNMENT_OFFSET = 0.375f;
@@ -23,67 +75,1353 @@ namespace gcn
         return sf::Color(color.r, color.g, color.b, color.a);
     }
 
+    // The vector kernels treat a Color as four consecutive ints.
+    typedef char ColorLayoutCheck[sizeof(Color) == 4 * sizeof(int) ? 1 : -1];
+
+    void SFMLGraphics::convertGuichanColorsToRGBA(const Color* colors, sf::Uint8* rgba, std::size_t count)
+    {
+        std::size_t i = 0;
+
+#if defined(GCN_SFML_SSE2)
+        // Four colors at a time: saturate the 32-bit components down to
+        // 16 and then 8 bits, which leaves them in RGBA order.
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&colors[i]));
+            const __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&colors[i + 1]));
+            const __m128i c2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&colors[i + 2]));
+            const __m128i c3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&colors[i + 3]));
+
+            const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), packed);
+        }
+#elif defined(GCN_SFML_NEON)
+        for (; i + 4 <= count; i += 4)
+        {
+            const int32x4_t c0 = vld1q_s32(reinterpret_cast<const int32_t*>(&colors[i]));
+            const int32x4_t c1 = vld1q_s32(reinterpret_cast<const int32_t*>(&colors[i + 1]));
+            const int32x4_t c2 = vld1q_s32(reinterpret_cast<const int32_t*>(&colors[i + 2]));
+            const int32x4_t c3 = vld1q_s32(reinterpret_cast<const int32_t*>(&colors[i + 3]));
+
+            const uint16x8_t low = vcombine_u16(vqmovun_s32(c0), vqmovun_s32(c1));
+            const uint16x8_t high = vcombine_u16(vqmovun_s32(c2), vqmovun_s32(c3));
+
+            vst1q_u8(rgba + i * 4, vcombine_u8(vqmovn_u16(low), vqmovn_u16(high)));
+        }
+#endif
+
+        for (; i < count; ++i)
+        {
+            rgba[i * 4] = static_cast<sf::Uint8>(std::min(std::max(colors[i].r, 0), 255));
+            rgba[i * 4 + 1] = static_cast<sf::Uint8>(std::min(std::max(colors[i].g, 0), 255));
+            rgba[i * 4 + 2] = static_cast<sf::Uint8>(std::min(std::max(colors[i].b, 0), 255));
+            rgba[i * 4 + 3] = static_cast<sf::Uint8>(std::min(std::max(colors[i].a, 0), 255));
+        }
+    }
+
+    void SFMLGraphics::convertRGBAToGuichanColors(const sf::Uint8* rgba, Color* colors, std::size_t count)
+    {
+        std::size_t i = 0;
+
+#if defined(GCN_SFML_SSE2)
+        // Four colors at a time: zero extend the bytes to 16 and then 32 bits.
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i * 4));
+            const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+            const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&colors[i]), _mm_unpacklo_epi16(low, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&colors[i + 1]), _mm_unpackhi_epi16(low, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&colors[i + 2]), _mm_unpacklo_epi16(high, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&colors[i + 3]), _mm_unpackhi_epi16(high, zero));
+        }
+#elif defined(GCN_SFML_NEON)
+        for (; i + 4 <= count; i += 4)
+        {
+            const uint8x16_t bytes = vld1q_u8(rgba + i * 4);
+            const uint16x8_t low = vmovl_u8(vget_low_u8(bytes));
+            const uint16x8_t high = vmovl_u8(vget_high_u8(bytes));
+
+            vst1q_s32(reinterpret_cast<int32_t*>(&colors[i]), vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(low))));
+            vst1q_s32(reinterpret_cast<int32_t*>(&colors[i + 1]), vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(low))));
+            vst1q_s32(reinterpret_cast<int32_t*>(&colors[i + 2]), vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(high))));
+            vst1q_s32(reinterpret_cast<int32_t*>(&colors[i + 3]), vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(high))));
+        }
+#endif
+
+        for (; i < count; ++i)
+        {
+            colors[i] = Color(rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2], rgba[i * 4 + 3]);
+        }
+    }
+
     SFMLGraphics::SFMLGraphics(sf::RenderTarget& target)
-        : mTarget(&target)
+        : mTarget(&target),
+          mBatchTexture(NULL),
+          mBlendMode(sf::BlendAlpha),
+          mFlushCount(0),
+          mPendingImageColor(128, 128, 128, 64),
+          mSoftwareClipping(false),
+          mDamageTracking(false),
+          mBackbuffer(NULL),
+          mPresentTarget(NULL),
+          mDamage(0, 0, 0, 0),
+          mCachedLayerBudget(32 * 1024 * 1024),
+          mFrameStatistics(FrameStatistics()),
+          mLastFrameStatistics(FrameStatistics()),
+          mStatisticsHistoryNext(0),
+          mStatisticsWindow(60),
+          mStatisticsTexture(NULL),
+          mBackendTimerDepth(0),
+          mCommandRecording(false),
+          mRecordingIndex(0),
+          mRecordingList(NULL),
+          mCapturing(false),
+          mExecutingList(false),
+          mReplayValid(false),
+          mReplayHits(0),
+          mReplayMisses(0)
+    {
+        mContextView = mTarget->getView();
+        mSize = mContextView.getSize();
+
+        mCachedLayerStatistics.hits = 0;
+        mCachedLayerStatistics.misses = 0;
+        mCachedLayerStatistics.evictions = 0;
+        mCachedLayerStatistics.layerCount = 0;
+        mCachedLayerStatistics.textureBytes = 0;
+
+        setColor(Color());
+    }
+
+    SFMLGraphics::~SFMLGraphics()
+    {
+        for (std::map<std::string, CachedLayer>::iterator it = mCachedLayers.begin(); it != mCachedLayers.end(); ++it)
+        {
+            delete it->second.texture;
+        }
+
+        delete mBackbuffer;
+    }
+
+    void SFMLGraphics::_beginDraw()
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLGraphics::_beginDraw");
+
+        mFrameStatistics = FrameStatistics();
+        mStatisticsTexture = NULL;
+        mExecutingList = false;
+
+        GCN_SFML_TIME_BACKEND();
+
+        if (mCommandRecording)
+        {
+            beginRecording();
+            return;
+        }
+
+        beginFrame();
+    }
+
+    void SFMLGraphics::_endDraw()
+    {
+        // The timer has to stop before the statistics are stored.
+        {
+            GCN_SFML_TRACE_SCOPE("SFMLGraphics::_endDraw");
+            GCN_SFML_TIME_BACKEND();
+
+            if (mRecordingList != NULL)
+            {
+                endRecording();
+            }
+            else
+            {
+                endFrame();
+            }
+        }
+
+        endFrameStatistics();
+    }
+
+    void SFMLGraphics::beginFrame()
+    {
+        // Save the view before drawing.
+        mContextView = mTarget->getView();
+        mSize = mContextView.getSize();
+
+        mFlushCount = 0;
+
+        if (mDamageTracking)
+        {
+            beginBackbufferFrame();
+            return;
+        }
+
+        pushClipArea(Rectangle(0, 0, static_cast<int>(mSize.x), static_cast<int>(mSize.y)));
+    }
+
+    void SFMLGraphics::endFrame()
+    {
+        popClipArea();
+
+        flush();
+
+        // Restore the view after drawing.
+        setTargetView(mContextView);
+
+        if (mPresentTarget != NULL)
+        {
+            mBackbuffer->display();
+
+            mTarget = mPresentTarget;
+            mContextView = mPresentView;
+            mSize = mContextView.getSize();
+            mPresentTarget = NULL;
+
+            presentBackbuffer();
+        }
+    }
+
+    void SFMLGraphics::setCommandRecording(bool commandRecording)
+    {
+        if (!mClipStack.empty())
+        {
+            throw GCN_EXCEPTION("Command recording can't be changed between _beginDraw() and _endDraw().");
+        }
+
+        mCommandRecording = commandRecording;
+        mReplayValid = false;
+        mCommandLists[0].clear();
+        mCommandLists[1].clear();
+    }
+
+    bool SFMLGraphics::isCommandRecording() const
+    {
+        return mCommandRecording;
+    }
+
+    const SFMLCommandList& SFMLGraphics::getLastCommandList() const
+    {
+        // endRecording() flips the index, so the last list is the other one.
+        return mCommandLists[mRecordingIndex ^ 1];
+    }
+
+    unsigned int SFMLGraphics::getReplayHits() const
+    {
+        return mReplayHits;
+    }
+
+    unsigned int SFMLGraphics::getReplayMisses() const
+    {
+        return mReplayMisses;
+    }
+
+    void SFMLGraphics::drawCommandList(const SFMLCommandList& list)
+    {
+        GCN_SFML_TIME_BACKEND();
+
+        const Color color = mColor;
+        const bool executingList = mExecutingList;
+        const std::vector<SFMLCommandList::Command>& commands = list.getCommands();
+
+        mExecutingList = true;
+
+        for (std::size_t i = 0; i < commands.size(); ++i)
+        {
+            const SFMLCommandList::Command& command = commands[i];
+
+            if (command.type >= SFMLCommandList::FillRectangle && command.type <= SFMLCommandList::DrawPoint)
+            {
+                const Color commandColor(command.color >> 24,
+                                         (command.color >> 16) & 0xff,
+                                         (command.color >> 8) & 0xff,
+                                         command.color & 0xff);
+
+                if (commandColor != mColor)
+                {
+                    setColor(commandColor);
+                }
+            }
+
+            switch (command.type)
+            {
+                case SFMLCommandList::PushClipArea:
+                    pushClipArea(Rectangle(command.x, command.y, command.width, command.height));
+                    break;
+                case SFMLCommandList::PopClipArea:
+                    popClipArea();
+                    break;
+                case SFMLCommandList::FillRectangle:
+                    fillRectangle(Rectangle(command.x, command.y, command.width, command.height));
+                    break;
+                case SFMLCommandList::DrawRectangle:
+                    drawRectangle(Rectangle(command.x, command.y, command.width, command.height));
+                    break;
+                case SFMLCommandList::DrawLine:
+                    drawLine(command.x, command.y, command.width, command.height);
+                    break;
+                case SFMLCommandList::DrawPoint:
+                    drawPoint(command.x, command.y);
+                    break;
+                case SFMLCommandList::DrawImage:
+                    drawImage(list.getImage(command.resource),
+                              command.srcX,
+                              command.srcY,
+                              command.x,
+                              command.y,
+                              command.width,
+                              command.height);
+                    break;
+                case SFMLCommandList::DrawText:
+                    drawCommandText(list.getFont(command.resource),
+                                    list.getString(command.first),
+                                    command.x,
+                                    command.y,
+                                    command.color);
+                    break;
+                case SFMLCommandList::DrawTexturedQuads:
+                    if (command.count > 0)
+                    {
+                        drawTexturedQuads(&list.getVertices()[command.first],
+                                          command.count,
+                                          list.getTexture(command.resource),
+                                          sf::Vector2f(0.0f, 0.0f));
+                    }
+                    break;
+                case SFMLCommandList::SetBlendMode:
+                    setBlendMode(list.getBlendMode(command.resource));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        mExecutingList = executingList;
+        setColor(color);
+    }
+
+    void SFMLGraphics::abortFrame()
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLGraphics::abortFrame");
+
+        // Nothing of the failed frame is drawn or kept.
+        mBatch.clear();
+        mCapturing = false;
+        mExecutingList = false;
+        mRecordingList = NULL;
+        mReplayValid = false;
+
+        // The outermost cached layer still being rendered holds the target
+        // of the frame. The contents of the layers are incomplete.
+        while (!mLayerStack.empty())
+        {
+            const LayerState& state = mLayerStack.back();
+
+            if (!state.direct)
+            {
+                std::map<std::string, CachedLayer>::iterator layer = mCachedLayers.find(state.id);
+
+                if (layer != mCachedLayers.end())
+                {
+                    layer->second.valid = false;
+                    layer->second.rendering = false;
+                }
+
+                mTarget = state.target;
+                mContextView = state.contextView;
+                mSize = state.size;
+            }
+
+            mLayerStack.pop_back();
+        }
+
+        mClipStack = std::stack<ClipRectangle>();
+
+        // The backbuffer only holds part of the frame.
+        if (mPresentTarget != NULL)
+        {
+            mTarget = mPresentTarget;
+            mContextView = mPresentView;
+            mSize = mContextView.getSize();
+            mPresentTarget = NULL;
+
+            damageAll();
+        }
+
+        setTargetView(mContextView);
+    }
+
+    void SFMLGraphics::beginRecording()
+    {
+        mContextView = mTarget->getView();
+        mSize = mContextView.getSize();
+
+        mRecordingList = &mCommandLists[mRecordingIndex];
+        mRecordingList->clear();
+
+        // Executing the list has to start out with the same blend mode.
+        mRecordingList->setBlendMode(mBlendMode);
+
+        // The clip stack is kept while recording, so widgets can query the
+        // clip area, but nothing touches the RenderTarget.
+        Graphics::pushClipArea(Rectangle(0, 0, static_cast<int>(mSize.x), static_cast<int>(mSize.y)));
+    }
+
+    void SFMLGraphics::endRecording()
+    {
+        Graphics::popClipArea();
+
+        SFMLCommandList& list = *mRecordingList;
+        const SFMLCommandList& previous = mCommandLists[mRecordingIndex ^ 1];
+        const bool unchanged = list.hasSameCommands(previous);
+
+        mRecordingList = NULL;
+        mRecordingIndex ^= 1;
+
+        const sf::View& view = mTarget->getView();
+        const bool sameView = view.getCenter() == mReplayContextView.getCenter()
+                              && view.getSize() == mReplayContextView.getSize()
+                              && view.getRotation() == mReplayContextView.getRotation()
+                              && view.getViewport() == mReplayContextView.getViewport();
+
+        if (unchanged && mReplayValid && sameView)
+        {
+            mReplayHits++;
+            replayFrame();
+            return;
+        }
+
+        // With damage tracking the backbuffer still holds the previous
+        // frame, so it is presented as is unless something was damaged.
+        if (unchanged && mDamageTracking && sameView && mBackbuffer != NULL && !hasDamage())
+        {
+            mReplayHits++;
+            presentBackbuffer();
+            return;
+        }
+
+        mReplayMisses++;
+
+        // Only where the frame differs from the previous one has to be
+        // redrawn in the backbuffer. Without a previous frame the backbuffer
+        // may hold anything, and after a view change everything moved.
+        if (mDamageTracking && !unchanged)
+        {
+            Rectangle changed;
+
+            if (!previous.getCommands().empty()
+                && sameView
+                && list.getChangedArea(previous, Rectangle(0, 0, static_cast<int>(mSize.x), static_cast<int>(mSize.y)), changed))
+            {
+                addDamage(changed);
+            }
+            else
+            {
+                damageAll();
+            }
+        }
+
+        // Without damage tracking, what the frame submits is kept so an
+        // unchanged frame can be submitted again as is.
+        mCapturing = !mDamageTracking;
+        mReplayOperations.clear();
+        mReplayVertices.clear();
+
+        beginFrame();
+        drawCommandList(list);
+        endFrame();
+
+        mCapturing = false;
+        mReplayValid = !mDamageTracking;
+        mReplayContextView = mContextView;
+    }
+
+    void SFMLGraphics::replayFrame()
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLGraphics::replayFrame");
+
+        for (std::size_t i = 0; i < mReplayOperations.size(); ++i)
+        {
+            const ReplayOperation& operation = mReplayOperations[i];
+
+            if (operation.vertexCount == 0)
+            {
+                setTargetView(operation.view);
+                continue;
+            }
+
+            sf::RenderStates states(operation.blendMode);
+            states.texture = operation.texture;
+
+            mTarget->draw(&mReplayVertices[operation.firstVertex], operation.vertexCount, sf::Quads, states);
+
+#ifdef GCN_SFML_ENABLE_STATISTICS
+            mFrameStatistics.drawCalls++;
+            mFrameStatistics.vertices += static_cast<unsigned int>(operation.vertexCount);
+
+            if (operation.texture != mStatisticsTexture)
+            {
+                mFrameStatistics.textureBinds++;
+                mStatisticsTexture = operation.texture;
+            }
+#endif
+        }
+    }
+
+    void SFMLGraphics::drawCommandText(Font* font, const std::string& text, int x, int y, sf::Uint32 color)
+    {
+        if (font == NULL)
+        {
+            return;
+        }
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->drawText(font, text, x, y);
+            return;
+        }
+
+        GCN_SFML_COUNT(textDraws, 1);
+
+        SFMLFont* sfmlFont = dynamic_cast<SFMLFont*>(font);
+
+        if (sfmlFont == NULL)
+        {
+            font->drawString(this, text, x, y);
+            return;
+        }
+
+        // The color of the font is part of the command. The font itself is
+        // left alone, as it may be in use on another thread.
+        sfmlFont->drawString(this,
+                             text,
+                             x,
+                             y,
+                             sf::Color(color >> 24, (color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff));
+    }
+
+    void SFMLGraphics::setRenderTarget(sf::RenderTarget& target)
     {
+        if (mPresentTarget != NULL)
+        {
+            throw GCN_EXCEPTION("The render target can't be changed between _beginDraw() and _endDraw() with damage tracking.");
+        }
+
+        if (mRecordingList != NULL)
+        {
+            throw GCN_EXCEPTION("The render target can't be changed between _beginDraw() and _endDraw() with command recording.");
+        }
+
+        mReplayValid = false;
+
+        flush();
+
+        mTarget = &target;
         mContextView = mTarget->getView();
         mSize = mContextView.getSize();
 
-        setColor(Color());
-    }
+        damageAll();
+    }
+
+    void SFMLGraphics::setDamageTracking(bool damageTracking)
+    {
+        if (!mClipStack.empty())
+        {
+            throw GCN_EXCEPTION("Damage tracking can't be changed between _beginDraw() and _endDraw().");
+        }
+
+        mDamageTracking = damageTracking;
+        mReplayValid = false;
+
+        if (!mDamageTracking)
+        {
+            delete mBackbuffer;
+            mBackbuffer = NULL;
+        }
+
+        damageAll();
+    }
+
+    bool SFMLGraphics::isDamageTracking() const
+    {
+        return mDamageTracking;
+    }
+
+    void SFMLGraphics::addDamage(const Rectangle& area)
+    {
+        if (area.width <= 0 || area.height <= 0)
+        {
+            return;
+        }
+
+        if (mDamage.width <= 0 || mDamage.height <= 0)
+        {
+            mDamage = area;
+            return;
+        }
+
+        const int left = std::min(mDamage.x, area.x);
+        const int top = std::min(mDamage.y, area.y);
+        const int right = std::max(mDamage.x + mDamage.width, area.x + area.width);
+        const int bottom = std::max(mDamage.y + mDamage.height, area.y + area.height);
+
+        mDamage = Rectangle(left, top, right - left, bottom - top);
+    }
+
+    void SFMLGraphics::damageAll()
+    {
+        const sf::Vector2f size = mPresentTarget != NULL ? mPresentView.getSize() : mContextView.getSize();
+
+        addDamage(Rectangle(0, 0, static_cast<int>(size.x), static_cast<int>(size.y)));
+    }
+
+    bool SFMLGraphics::hasDamage() const
+    {
+        return mDamage.width > 0 && mDamage.height > 0;
+    }
+
+    void SFMLGraphics::presentBackbuffer()
+    {
+        if (mBackbuffer == NULL || mPresentTarget != NULL)
+        {
+            return;
+        }
+
+        const sf::Vector2u size = mBackbuffer->getSize();
+        const sf::View previousView = mTarget->getView();
+
+        // One to one with the GUI coordinates, like the root clip area.
+        setTargetView(sf::View(sf::FloatRect(0.0f, 0.0f, static_cast<float>(size.x), static_cast<float>(size.y))));
+
+        sf::Sprite sprite(mBackbuffer->getTexture());
+        mTarget->draw(sprite, sf::RenderStates(sf::BlendMode(sf::BlendMode::One, sf::BlendMode::OneMinusSrcAlpha)));
+        GCN_SFML_COUNT(drawCalls, 1);
+        GCN_SFML_COUNT(vertices, 4);
+        GCN_SFML_COUNT(textureBinds, 1);
+        mStatisticsTexture = &mBackbuffer->getTexture();
+
+        setTargetView(previousView);
+    }
+
+    bool SFMLGraphics::beginCachedLayer(const std::string& id, const Rectangle& area)
+    {
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            throw GCN_EXCEPTION("Cached layers can't be used with command recording.");
+        }
+
+        if (mClipStack.empty())
+        {
+            throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
+        }
+
+        const ClipRectangle& top = mClipStack.top();
+
+        LayerState state;
+        state.id = id;
+        state.direct = false;
+        state.area = Rectangle(area.x + top.xOffset, area.y + top.yOffset, area.width, area.height);
+
+        std::map<std::string, CachedLayer>::iterator layer = mCachedLayers.find(id);
+
+        if (layer != mCachedLayers.end() && !layer->second.rendering)
+        {
+            const sf::Vector2u size = layer->second.texture->getSize();
+
+            if (layer->second.valid
+                && size.x == static_cast<unsigned int>(area.width)
+                && size.y == static_cast<unsigned int>(area.height))
+            {
+                mCachedLayerStatistics.hits++;
+                mCachedLayerUse.splice(mCachedLayerUse.begin(), mCachedLayerUse, layer->second.use);
+
+                drawCachedLayer(layer->second.texture->getTexture(), state.area);
+
+                return false;
+            }
+
+            eraseCachedLayer(layer);
+            layer = mCachedLayers.end();
+        }
+
+        mCachedLayerStatistics.misses++;
+
+        const std::size_t bytes = static_cast<std::size_t>(std::max(area.width, 0)) * std::max(area.height, 0) * 4;
+
+        sf::RenderTexture* texture = NULL;
+
+        if (layer == mCachedLayers.end() && bytes > 0 && makeRoomForCachedLayer(bytes))
+        {
+            texture = new sf::RenderTexture();
+
+            if (!texture->create(area.width, area.height))
+            {
+                delete texture;
+                texture = NULL;
+            }
+        }
+
+        if (texture == NULL)
+        {
+            // Too large, empty or already being rendered: draw it directly.
+            state.direct = true;
+            mLayerStack.push_back(state);
+            pushClipArea(area);
+
+            return true;
+        }
+
+        mCachedLayerUse.push_front(id);
+
+        CachedLayer& created = mCachedLayers[id];
+        created.texture = texture;
+        created.valid = false;
+        created.rendering = true;
+        created.use = mCachedLayerUse.begin();
+
+        mCachedLayerStatistics.layerCount = mCachedLayers.size();
+        mCachedLayerStatistics.textureBytes += bytes;
+
+        // Render the contents into the texture with a clip stack of their
+        // own, as if the texture was the whole target.
+        flush();
+
+        state.target = mTarget;
+        state.contextView = mContextView;
+        state.clipView = mClipView;
+        state.size = mSize;
+        state.clipStack = mClipStack;
+        mLayerStack.push_back(state);
+
+        mClipStack = std::stack<ClipRectangle>();
+        mTarget = texture;
+        mContextView = texture->getDefaultView();
+        mSize = mContextView.getSize();
+
+        texture->clear(sf::Color::Transparent);
+        pushClipArea(Rectangle(0, 0, area.width, area.height));
+
+        return true;
+    }
+
+    void SFMLGraphics::endCachedLayer()
+    {
+        GCN_SFML_TIME_BACKEND();
+
+        if (mLayerStack.empty())
+        {
+            throw GCN_EXCEPTION("endCachedLayer() called without a matching beginCachedLayer().");
+        }
+
+        const LayerState state = mLayerStack.back();
+        mLayerStack.pop_back();
+
+        if (state.direct)
+        {
+            popClipArea();
+            return;
+        }
+
+        popClipArea();
+        flush();
+
+        std::map<std::string, CachedLayer>::iterator layer = mCachedLayers.find(state.id);
+        layer->second.texture->display();
+        layer->second.valid = true;
+        layer->second.rendering = false;
+
+        mTarget = state.target;
+        mContextView = state.contextView;
+        mClipView = state.clipView;
+        mSize = state.size;
+        mClipStack = state.clipStack;
+        setTargetView(mClipView);
+
+        drawCachedLayer(layer->second.texture->getTexture(), state.area);
+    }
+
+    void SFMLGraphics::invalidateCachedLayer(const std::string& id)
+    {
+        std::map<std::string, CachedLayer>::iterator layer = mCachedLayers.find(id);
+
+        if (layer != mCachedLayers.end())
+        {
+            layer->second.valid = false;
+        }
+    }
+
+    void SFMLGraphics::invalidateCachedLayers()
+    {
+        for (std::map<std::string, CachedLayer>::iterator it = mCachedLayers.begin(); it != mCachedLayers.end(); ++it)
+        {
+            it->second.valid = false;
+        }
+    }
+
+    void SFMLGraphics::setCachedLayerBudget(std::size_t bytes)
+    {
+        mCachedLayerBudget = bytes;
+        makeRoomForCachedLayer(0);
+    }
+
+    std::size_t SFMLGraphics::getCachedLayerBudget() const
+    {
+        return mCachedLayerBudget;
+    }
+
+    const SFMLGraphics::CachedLayerStatistics& SFMLGraphics::getCachedLayerStatistics() const
+    {
+        return mCachedLayerStatistics;
+    }
+
+    void SFMLGraphics::drawCachedLayer(const sf::Texture& texture, const Rectangle& area)
+    {
+        const float x = static_cast<float>(area.x);
+        const float y = static_cast<float>(area.y);
+        const float w = static_cast<float>(area.width);
+        const float h = static_cast<float>(area.height);
+
+        const sf::Vertex quad[4] =
+        {
+            sf::Vertex(sf::Vector2f(x, y), sf::Color::White, sf::Vector2f(0.0f, 0.0f)),
+            sf::Vertex(sf::Vector2f(x + w, y), sf::Color::White, sf::Vector2f(w, 0.0f)),
+            sf::Vertex(sf::Vector2f(x + w, y + h), sf::Color::White, sf::Vector2f(w, h)),
+            sf::Vertex(sf::Vector2f(x, y + h), sf::Color::White, sf::Vector2f(0.0f, h))
+        };
+
+        // The texture holds premultiplied colors.
+        const sf::BlendMode blendMode = mBlendMode;
+        setBlendMode(sf::BlendMode(sf::BlendMode::One, sf::BlendMode::OneMinusSrcAlpha));
+        drawTexturedQuads(quad, 4, &texture, sf::Vector2f(0.0f, 0.0f));
+        setBlendMode(blendMode);
+    }
+
+    bool SFMLGraphics::makeRoomForCachedLayer(std::size_t bytes)
+    {
+        if (bytes > mCachedLayerBudget)
+        {
+            return false;
+        }
+
+        std::list<std::string>::iterator it = mCachedLayerUse.end();
+
+        while (mCachedLayerStatistics.textureBytes + bytes > mCachedLayerBudget
+               && it != mCachedLayerUse.begin())
+        {
+            --it;
+
+            std::map<std::string, CachedLayer>::iterator layer = mCachedLayers.find(*it);
+
+            // Layers being rendered right now can't be dropped.
+            if (layer->second.rendering)
+            {
+                continue;
+            }
+
+            // Step off the entry before it is erased from the list.
+            std::list<std::string>::iterator next = it;
+            ++next;
+            eraseCachedLayer(layer);
+            it = next;
+
+            mCachedLayerStatistics.evictions++;
+        }
+
+        return mCachedLayerStatistics.textureBytes + bytes <= mCachedLayerBudget;
+    }
+
+    void SFMLGraphics::eraseCachedLayer(std::map<std::string, CachedLayer>::iterator layer)
+    {
+        const sf::Vector2u size = layer->second.texture->getSize();
+
+        mCachedLayerStatistics.textureBytes -= static_cast<std::size_t>(size.x) * size.y * 4;
+
+        mCachedLayerUse.erase(layer->second.use);
+        delete layer->second.texture;
+        mCachedLayers.erase(layer);
+
+        mCachedLayerStatistics.layerCount = mCachedLayers.size();
+    }
+
+    void SFMLGraphics::beginBackbufferFrame()
+    {
+        const unsigned int width = static_cast<unsigned int>(mSize.x + 0.5f);
+        const unsigned int height = static_cast<unsigned int>(mSize.y + 0.5f);
+
+        if (mBackbuffer == NULL)
+        {
+            mBackbuffer = new sf::RenderTexture();
+        }
+
+        if (mBackbuffer->getSize() != sf::Vector2u(width, height))
+        {
+            if (!mBackbuffer->create(width, height))
+            {
+                throw GCN_EXCEPTION("Unable to create the backbuffer for damage tracking.");
+            }
+
+            mBackbuffer->clear(sf::Color::Transparent);
+            damageAll();
+        }
+
+        // Everything is drawn into the backbuffer until _endDraw().
+        mPresentTarget = mTarget;
+        mPresentView = mContextView;
+        mTarget = mBackbuffer;
+        mContextView = mBackbuffer->getDefaultView();
+        mSize = mContextView.getSize();
+
+        pushClipArea(Rectangle(0, 0, static_cast<int>(mSize.x), static_cast<int>(mSize.y)));
+
+        // Limit the root clip area to the damage. Its offset stays at the
+        // origin, so widgets are still positioned relative to the target.
+        ClipRectangle& root = mClipStack.top();
+        Rectangle damaged = mDamage;
+
+        if (!intersectWithClipArea(damaged))
+        {
+            damaged = Rectangle(0, 0, 0, 0);
+        }
+
+        root.x = damaged.x;
+        root.y = damaged.y;
+        root.width = damaged.width;
+        root.height = damaged.height;
+
+        mClipView = convertClipRectangleToView(root);
+        setTargetView(mClipView);
+
+        mDamage = Rectangle(0, 0, 0, 0);
+
+        if (damaged.width <= 0 || damaged.height <= 0)
+        {
+            return;
+        }
+
+        // Clear the damaged area to transparent. The viewport of the root
+        // view keeps the quad inside the damage.
+        const float w = mSize.x;
+        const float h = mSize.y;
+        const sf::Vertex clear[4] =
+        {
+            sf::Vertex(sf::Vector2f(0.0f, 0.0f), sf::Color::Transparent),
+            sf::Vertex(sf::Vector2f(w, 0.0f), sf::Color::Transparent),
+            sf::Vertex(sf::Vector2f(w, h), sf::Color::Transparent),
+            sf::Vertex(sf::Vector2f(0.0f, h), sf::Color::Transparent)
+        };
+
+        mTarget->draw(clear, 4, sf::Quads, sf::RenderStates(sf::BlendNone));
+        GCN_SFML_COUNT(drawCalls, 1);
+        GCN_SFML_COUNT(vertices, 4);
+    }
+
+    bool SFMLGraphics::pushClipArea(Rectangle area)
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLGraphics::pushClipArea");
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->pushClipArea(area);
+            return Graphics::pushClipArea(area);
+        }
+
+        // With software clipping only the outermost clip area sets a view,
+        // which is then kept for the whole frame.
+        const bool changeView = !mSoftwareClipping || mClipStack.empty();
+
+        if (changeView)
+        {
+            flush();
+        }
+
+        bool result = Graphics::pushClipArea(area);
+
+        if (result && changeView)
+        {
+            mClipView = convertClipRectangleToView(mClipStack.top());
+            setTargetView(mClipView);
+        }
+
+        return result;
+    }
+
+    void SFMLGraphics::popClipArea()
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLGraphics::popClipArea");
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->popClipArea();
+            Graphics::popClipArea();
+            return;
+        }
+
+        if (mSoftwareClipping)
+        {
+            Graphics::popClipArea();
+            return;
+        }
+
+        flush();
+
+        Graphics::popClipArea();
+
+        if (mClipStack.empty())
+        {
+            return;
+        }
+
+        mClipView = convertClipRectangleToView(mClipStack.top());
+        setTargetView(mClipView);
+    }
+
+    void SFMLGraphics::setSoftwareClipping(bool softwareClipping)
+    {
+        if (!mClipStack.empty())
+        {
+            throw GCN_EXCEPTION("The clipping mode can't be changed between _beginDraw() and _endDraw().");
+        }
+
+        mSoftwareClipping = softwareClipping;
+        mReplayValid = false;
+    }
+
+    bool SFMLGraphics::isSoftwareClipping() const
+    {
+        return mSoftwareClipping;
+    }
+
+    sf::RenderTarget& SFMLGraphics::getRenderTarget() const {
+        return *mTarget;
+    }
+
+    void SFMLGraphics::flush()
+    {
+        if (mBatch.empty())
+        {
+            return;
+        }
+
+        GCN_SFML_TIME_BACKEND();
+
+        sf::RenderStates states(mBlendMode);
+        states.texture = mBatchTexture;
+
+        mTarget->draw(&mBatch[0], mBatch.size(), sf::Quads, states);
+
+        if (mCapturing)
+        {
+            ReplayOperation operation;
+            operation.blendMode = mBlendMode;
+            operation.texture = mBatchTexture;
+            operation.firstVertex = mReplayVertices.size();
+            operation.vertexCount = mBatch.size();
+            mReplayOperations.push_back(operation);
+            mReplayVertices.insert(mReplayVertices.end(), mBatch.begin(), mBatch.end());
+        }
+
+#ifdef GCN_SFML_ENABLE_STATISTICS
+        mFrameStatistics.drawCalls++;
+        mFrameStatistics.vertices += static_cast<unsigned int>(mBatch.size());
+
+        if (mBatchTexture != mStatisticsTexture)
+        {
+            mFrameStatistics.textureBinds++;
+            mStatisticsTexture = mBatchTexture;
+        }
+#endif
+
+        // Keep the capacity around so the next frame doesn't reallocate.
+        mBatch.clear();
+        mFlushCount++;
+    }
+
+    void SFMLGraphics::setBlendMode(const sf::BlendMode& blendMode)
+    {
+        if (mRecordingList != NULL && blendMode != mBlendMode)
+        {
+            mRecordingList->setBlendMode(blendMode);
+            mBlendMode = blendMode;
+            return;
+        }
+
+        if (blendMode != mBlendMode)
+        {
+            flush();
+            mBlendMode = blendMode;
+        }
+    }
+
+    const sf::BlendMode& SFMLGraphics::getBlendMode() const
+    {
+        return mBlendMode;
+    }
+
+    void SFMLGraphics::setPendingImageColor(const Color& color)
+    {
+        mPendingImageColor = color;
+    }
+
+    const Color& SFMLGraphics::getPendingImageColor() const
+    {
+        return mPendingImageColor;
+    }
+
+    unsigned int SFMLGraphics::getFlushCount() const
+    {
+        return mFlushCount;
+    }
+
+    const SFMLGraphics::FrameStatistics& SFMLGraphics::getFrameStatistics() const
+    {
+        return mLastFrameStatistics;
+    }
+
+    SFMLGraphics::FrameStatistics SFMLGraphics::getAverageFrameStatistics() const
+    {
+        FrameStatistics average = FrameStatistics();
+
+        if (mStatisticsHistory.empty())
+        {
+            return average;
+        }
+
+        double drawCalls = 0.0;
+        double vertices = 0.0;
+        double textureBinds = 0.0;
+        double viewChanges = 0.0;
+        double rejectedPrimitives = 0.0;
+        double textDraws = 0.0;
+        double cpuTime = 0.0;
+
+        for (std::size_t i = 0; i < mStatisticsHistory.size(); ++i)
+        {
+            const FrameStatistics& frame = mStatisticsHistory[i];
+
+            drawCalls += frame.drawCalls;
+            vertices += frame.vertices;
+            textureBinds += frame.textureBinds;
+            viewChanges += frame.viewChanges;
+            rejectedPrimitives += frame.rejectedPrimitives;
+            textDraws += frame.textDraws;
+            cpuTime += frame.cpuTime;
+        }
+
+        const double frames = static_cast<double>(mStatisticsHistory.size());
 
-    void SFMLGraphics::_beginDraw()
-    {
-        // Save the view before drawing.
-        mContextView = mTarget->getView();
-        mSize = mContextView.getSize();
+        average.drawCalls = static_cast<unsigned int>(drawCalls / frames + 0.5);
+        average.vertices = static_cast<unsigned int>(vertices / frames + 0.5);
+        average.textureBinds = static_cast<unsigned int>(textureBinds / frames + 0.5);
+        average.viewChanges = static_cast<unsigned int>(viewChanges / frames + 0.5);
+        average.rejectedPrimitives = static_cast<unsigned int>(rejectedPrimitives / frames + 0.5);
+        average.textDraws = static_cast<unsigned int>(textDraws / frames + 0.5);
+        average.cpuTime = static_cast<float>(cpuTime / frames);
 
-        pushClipArea(Rectangle(0, 0, static_cast<int>(mSize.x), static_cast<int>(mSize.y)));
+        return average;
     }
 
-    void SFMLGraphics::_endDraw()
+    void SFMLGraphics::setStatisticsWindow(unsigned int frames)
     {
-        popClipArea();
+        mStatisticsWindow = std::max(frames, 1u);
+        mStatisticsHistory.clear();
+        mStatisticsHistoryNext = 0;
+    }
 
-        // Restore the view after drawing.
-        mTarget->setView(mContextView);
+    unsigned int SFMLGraphics::getStatisticsWindow() const
+    {
+        return mStatisticsWindow;
     }
 
-    void SFMLGraphics::setRenderTarget(sf::RenderTarget& target)
+    void SFMLGraphics::setTargetView(const sf::View& view)
     {
-        mTarget = &target;
-        mContextView = mTarget->getView();
-        mSize = mContextView.getSize();
+        mTarget->setView(view);
+        GCN_SFML_COUNT(viewChanges, 1);
+
+        if (mCapturing)
+        {
+            ReplayOperation operation;
+            operation.view = view;
+            operation.texture = NULL;
+            operation.firstVertex = 0;
+            operation.vertexCount = 0;
+            mReplayOperations.push_back(operation);
+        }
     }
 
-    bool SFMLGraphics::pushClipArea(Rectangle area)
+    void SFMLGraphics::endFrameStatistics()
     {
-        bool result = Graphics::pushClipArea(area);
+#ifdef GCN_SFML_ENABLE_STATISTICS
+        mLastFrameStatistics = mFrameStatistics;
 
-        if (result)
+        if (mStatisticsHistory.size() < mStatisticsWindow)
+        {
+            mStatisticsHistory.push_back(mFrameStatistics);
+        }
+        else
         {
-            const sf::View clippingView = convertClipRectangleToView(mClipStack.top());
-            mTarget->setView(clippingView);
+            mStatisticsHistory[mStatisticsHistoryNext] = mFrameStatistics;
         }
 
-        return result;
+        mStatisticsHistoryNext = (mStatisticsHistoryNext + 1) % mStatisticsWindow;
+#endif
     }
 
-    void SFMLGraphics::popClipArea()
+    void SFMLGraphics::drawUnbatched(const sf::Drawable& drawable, const sf::FloatRect& bounds)
     {
-        Graphics::popClipArea();
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            throw GCN_EXCEPTION("drawUnbatched() can't be used with command recording.");
+        }
 
         if (mClipStack.empty())
         {
+            throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
+        }
+
+        const ClipRectangle& top = mClipStack.top();
+
+        const float clipLeft = static_cast<float>(top.x);
+        const float clipTop = static_cast<float>(top.y);
+        const float clipRight = static_cast<float>(top.x + top.width);
+        const float clipBottom = static_cast<float>(top.y + top.height);
+
+        if (bounds.left >= clipRight
+            || bounds.top >= clipBottom
+            || bounds.left + bounds.width <= clipLeft
+            || bounds.top + bounds.height <= clipTop)
+        {
+            GCN_SFML_COUNT(rejectedPrimitives, 1);
             return;
         }
 
-        const sf::View clippingView = convertClipRectangleToView(mClipStack.top());
-        mTarget->setView(clippingView);
+        flush();
+
+        // A drawable which sticks out of the clip area can't be trimmed on
+        // the CPU, so the view of the clip area is set just for this draw.
+        const bool needsClippingView = mSoftwareClipping
+            && (bounds.left < clipLeft
+                || bounds.top < clipTop
+                || bounds.left + bounds.width > clipRight
+                || bounds.top + bounds.height > clipBottom);
+
+        if (needsClippingView)
+        {
+            setTargetView(convertClipRectangleToView(top));
+        }
+
+        mTarget->draw(drawable);
+        GCN_SFML_COUNT(drawCalls, 1);
+        mStatisticsTexture = NULL;
+
+        if (needsClippingView)
+        {
+            setTargetView(mClipView);
+        }
     }
 
-    sf::RenderTarget& SFMLGraphics::getRenderTarget() const {
-        return *mTarget;
+    void SFMLGraphics::drawTexturedQuads(const sf::Vertex* vertices,
+                                         std::size_t vertexCount,
+                                         const sf::Texture* texture,
+                                         const sf::Vector2f& offset)
+    {
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->drawTexturedQuads(vertices, vertexCount, texture, offset);
+            return;
+        }
+
+        if (mClipStack.empty())
+        {
+            throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
+        }
+
+        const ClipRectangle& top = mClipStack.top();
+
+        const float clipLeft = static_cast<float>(top.x);
+        const float clipTop = static_cast<float>(top.y);
+        const float clipRight = static_cast<float>(top.x + top.width);
+        const float clipBottom = static_cast<float>(top.y + top.height);
+
+        for (std::size_t i = 0; i + 3 < vertexCount; i += 4)
+        {
+            const sf::Vertex* source = vertices + i;
+
+            const float left = source[0].position.x + offset.x;
+            const float topEdge = source[0].position.y + offset.y;
+            const float right = source[2].position.x + offset.x;
+            const float bottom = source[2].position.y + offset.y;
+
+            if (left >= clipRight
+                || topEdge >= clipBottom
+                || right <= clipLeft
+                || bottom <= clipTop)
+            {
+                GCN_SFML_COUNT(rejectedPrimitives, 1);
+                continue;
+            }
+
+            sf::Vertex quad[4] =
+            {
+                source[0], source[1], source[2], source[3]
+            };
+
+            float x1 = left;
+            float y1 = topEdge;
+            float x2 = right;
+            float y2 = bottom;
+            float u1 = source[0].texCoords.x;
+            float v1 = source[0].texCoords.y;
+            float u2 = source[2].texCoords.x;
+            float v2 = source[2].texCoords.y;
+
+            // Trim the quad and its texture coordinates by the same fraction.
+            if (x1 < clipLeft)
+            {
+                u1 += (u2 - u1) * (clipLeft - x1) / (x2 - x1);
+                x1 = clipLeft;
+            }
+
+            if (x2 > clipRight)
+            {
+                u2 -= (u2 - u1) * (x2 - clipRight) / (x2 - x1);
+                x2 = clipRight;
+            }
+
+            if (y1 < clipTop)
+            {
+                v1 += (v2 - v1) * (clipTop - y1) / (y2 - y1);
+                y1 = clipTop;
+            }
+
+            if (y2 > clipBottom)
+            {
+                v2 -= (v2 - v1) * (y2 - clipBottom) / (y2 - y1);
+                y2 = clipBottom;
+            }
+
+            quad[0].position = sf::Vector2f(x1, y1);
+            quad[1].position = sf::Vector2f(x2, y1);
+            quad[2].position = sf::Vector2f(x2, y2);
+            quad[3].position = sf::Vector2f(x1, y2);
+            quad[0].texCoords = sf::Vector2f(u1, v1);
+            quad[1].texCoords = sf::Vector2f(u2, v1);
+            quad[2].texCoords = sf::Vector2f(u2, v2);
+            quad[3].texCoords = sf::Vector2f(u1, v2);
+
+            addQuad(quad, texture);
+        }
     }
 
     void SFMLGraphics::drawImage(const Image* image,
@@ -94,6 +1432,8 @@ namespace gcn
                                 int width,
                                 int height)
     {
+        GCN_SFML_TIME_BACKEND();
+
         const SFMLImage* srcImage = dynamic_cast<const SFMLImage*>(image);
 
         if (srcImage == NULL)
@@ -101,27 +1441,117 @@ namespace gcn
             throw GCN_EXCEPTION("Trying to draw an image of unknown format, must be an SFMLImage.");
         }
 
+        // Images still being loaded in the background are drawn as a
+        // placeholder of the same size.
+        if (!srcImage->isLoaded())
+        {
+            if (srcImage->isPending() && mPendingImageColor.a > 0)
+            {
+                const Color color = mColor;
+                setColor(mPendingImageColor);
+                fillRectangle(Rectangle(dstX, dstY, width, height));
+                setColor(color);
+            }
+
+            return;
+        }
+
+        // Pixels changed with putPixel() are uploaded before the image is
+        // drawn. Batched quads using the old pixels must be drawn first.
+        // Recorded images were uploaded while recording, and a list may be
+        // executed on another thread than the one editing the image.
+        if (!mExecutingList && srcImage->hasPendingPixelChanges())
+        {
+            flush();
+            srcImage->uploadPixelChanges();
+        }
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->drawImage(image, srcX, srcY, dstX, dstY, width, height);
+            return;
+        }
+
         if (mClipStack.empty())
         {
             throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
         }
 
         const ClipRectangle& top = mClipStack.top();
+        const sf::IntRect& textureRect = srcImage->getTextureRect();
+
+        // Source pixels outside of the image are left out, as in a shared
+        // texture they belong to the neighbours of the image.
+        if (srcX < 0)
+        {
+            dstX -= srcX;
+            width += srcX;
+            srcX = 0;
+        }
 
-        dstX += top.xOffset;
-        dstY += top.yOffset;
+        if (srcY < 0)
+        {
+            dstY -= srcY;
+            height += srcY;
+            srcY = 0;
+        }
 
-        const sf::IntRect srcRect(srcX, srcY, width, height);
+        width = std::min(width, textureRect.width - srcX);
+        height = std::min(height, textureRect.height - srcY);
 
-        mSprite.setTexture(*srcImage->getTexture(), false);
-        mSprite.setTextureRect(srcRect);
-        mSprite.setPosition(static_cast<float>(dstX), static_cast<float>(dstY));
-        
-        mTarget->draw(mSprite);
+        if (width <= 0 || height <= 0)
+        {
+            return;
+        }
+
+        const Rectangle destination(dstX + top.xOffset, dstY + top.yOffset, width, height);
+        Rectangle clipped = destination;
+
+        if (!intersectWithClipArea(clipped))
+        {
+            GCN_SFML_COUNT(rejectedPrimitives, 1);
+            return;
+        }
+
+        // The source rectangle is trimmed along with the destination and
+        // moved to where the image lives in its (possibly shared) texture.
+
+        srcX += clipped.x - destination.x + textureRect.left;
+        srcY += clipped.y - destination.y + textureRect.top;
+        dstX = clipped.x;
+        dstY = clipped.y;
+        width = clipped.width;
+        height = clipped.height;
+
+        const float x = static_cast<float>(dstX);
+        const float y = static_cast<float>(dstY);
+        const float w = static_cast<float>(width);
+        const float h = static_cast<float>(height);
+        const float u = static_cast<float>(srcX);
+        const float v = static_cast<float>(srcY);
+
+        // Same geometry sf::Sprite would produce, minus the color modulation.
+        sf::Vertex quad[4] =
+        {
+            sf::Vertex(sf::Vector2f(x, y), sf::Color::White, sf::Vector2f(u, v)),
+            sf::Vertex(sf::Vector2f(x + w, y), sf::Color::White, sf::Vector2f(u + w, v)),
+            sf::Vertex(sf::Vector2f(x + w, y + h), sf::Color::White, sf::Vector2f(u + w, v + h)),
+            sf::Vertex(sf::Vector2f(x, y + h), sf::Color::White, sf::Vector2f(u, v + h))
+        };
+
+        addQuad(quad, srcImage->getTexture());
     }
 
     void SFMLGraphics::drawPoint(int x, int y)
     {
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->drawPoint(x, y, mColor);
+            return;
+        }
+
         if (mClipStack.empty())
         {
             throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
@@ -132,11 +1562,25 @@ namespace gcn
         x += top.xOffset;
         y += top.yOffset;
 
+        if (!top.isContaining(x, y))
+        {
+            GCN_SFML_COUNT(rejectedPrimitives, 1);
+            return;
+        }
+
         _drawFauxPixel(x, y);
     }
 
     void SFMLGraphics::drawLine(int x1, int y1, int x2, int y2)
     {
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->drawLine(x1, y1, x2, y2, mColor);
+            return;
+        }
+
         if (y1 == y2)
         {
             drawHorizontalLine(x1, y1, x2);
@@ -156,6 +1600,14 @@ namespace gcn
 
     void SFMLGraphics::drawRectangle(const Rectangle& rectangle)
     {
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->drawRectangle(rectangle, mColor);
+            return;
+        }
+
         if (mClipStack.empty())
         {
             throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
@@ -175,6 +1627,14 @@ namespace gcn
 
     void SFMLGraphics::fillRectangle(const Rectangle& rectangle)
     {
+        GCN_SFML_TIME_BACKEND();
+
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->fillRectangle(rectangle, mColor);
+            return;
+        }
+
         if (mClipStack.empty())
         {
             throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
@@ -182,20 +1642,21 @@ namespace gcn
 
         const ClipRectangle& top = mClipStack.top();
 
-        const float x = static_cast<float>(rectangle.x + top.xOffset);
-        const float y = static_cast<float>(rectangle.y + top.yOffset);
-        const float w = static_cast<float>(rectangle.width);
-        const float h = static_cast<float>(rectangle.height);
+        Rectangle area(rectangle.x + top.xOffset,
+                       rectangle.y + top.yOffset,
+                       rectangle.width,
+                       rectangle.height);
 
-        sf::Vertex rect[4] = 
+        if (!intersectWithClipArea(area))
         {
-            sf::Vertex(sf::Vector2f(x, y), mSfmlColor),
-            sf::Vertex(sf::Vector2f(x + w, y), mSfmlColor),
-            sf::Vertex(sf::Vector2f(x + w, y + h), mSfmlColor),
-            sf::Vertex(sf::Vector2f(x, y + h), mSfmlColor)
-        };
+            GCN_SFML_COUNT(rejectedPrimitives, 1);
+            return;
+        }
 
-        mTarget->draw(rect, 4, sf::Quads);
+        addRectangle(static_cast<float>(area.x),
+                     static_cast<float>(area.y),
+                     static_cast<float>(area.width),
+                     static_cast<float>(area.height));
     }
 
     void SFMLGraphics::drawText(const std::string& text,
@@ -203,6 +1664,8 @@ namespace gcn
                                 int y,
                                 Alignment alignment)
     {
+        GCN_SFML_TIME_BACKEND();
+
         if (mFont == NULL)
         {
             GCN_EXCEPTION("No font set in graphics.");
@@ -221,6 +1684,13 @@ namespace gcn
             x -= textWidth;
         }
 
+        if (mRecordingList != NULL)
+        {
+            mRecordingList->drawText(mFont, text, x, y);
+            return;
+        }
+
+        GCN_SFML_COUNT(textDraws, 1);
         mFont->drawString(this, text, x, y);
     }
 
@@ -264,19 +1734,54 @@ namespace gcn
         return clippingView;
     }
 
+    bool SFMLGraphics::intersectWithClipArea(Rectangle& rectangle) const
+    {
+        const ClipRectangle& top = mClipStack.top();
+
+        const int left = std::max(rectangle.x, top.x);
+        const int upper = std::max(rectangle.y, top.y);
+        const int right = std::min(rectangle.x + rectangle.width, top.x + top.width);
+        const int lower = std::min(rectangle.y + rectangle.height, top.y + top.height);
+
+        if (left >= right || upper >= lower)
+        {
+            return false;
+        }
+
+        rectangle.x = left;
+        rectangle.y = upper;
+        rectangle.width = right - left;
+        rectangle.height = lower - upper;
+
+        return true;
+    }
+
     void SFMLGraphics::_drawFauxPixel(int x, int y) {
-        float px = static_cast<float>(x);
-        float py = static_cast<float>(y);
+        addRectangle(static_cast<float>(x), static_cast<float>(y), 1, 1);
+    }
 
-        sf::Vertex rect[4] = 
+    void SFMLGraphics::addQuad(const sf::Vertex* quad, const sf::Texture* texture)
+    {
+        if (texture != mBatchTexture)
+        {
+            flush();
+            mBatchTexture = texture;
+        }
+
+        mBatch.insert(mBatch.end(), quad, quad + 4);
+    }
+
+    void SFMLGraphics::addRectangle(float x, float y, float width, float height)
+    {
+        sf::Vertex rect[4] =
         {
-            sf::Vertex(sf::Vector2f(px, py), mSfmlColor),
-            sf::Vertex(sf::Vector2f(px + 1, py), mSfmlColor),
-            sf::Vertex(sf::Vector2f(px + 1, py + 1), mSfmlColor),
-            sf::Vertex(sf::Vector2f(px, py + 1), mSfmlColor)
+            sf::Vertex(sf::Vector2f(x, y), mSfmlColor),
+            sf::Vertex(sf::Vector2f(x + width, y), mSfmlColor),
+            sf::Vertex(sf::Vector2f(x + width, y + height), mSfmlColor),
+            sf::Vertex(sf::Vector2f(x, y + height), mSfmlColor)
         };
 
-        mTarget->draw(rect, 4, sf::Quads);
+        addQuad(rect, NULL);
     }
 
     void SFMLGraphics::drawHorizontalLine(int x1, int y, int x2) {
@@ -291,19 +1796,46 @@ namespace gcn
         x2 += top.xOffset;
         y += top.yOffset;
 
-        if (y < top.y || y >= top.y + top.height)
+        if(x1 > x2) {
+            std::swap(x1, x2);
+        }
+
+        drawHorizontalSpan(x1, x2, y);
+    }
+
+    void SFMLGraphics::drawVerticalLine(int x, int y1, int y2) {
+        if (mClipStack.empty())
         {
-            return;
+            throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
         }
 
-        if(x1 > x2) {
-            std::swap(x1, x2);
+        const ClipRectangle& top = mClipStack.top();
+
+        x += top.xOffset;
+        y1 += top.yOffset;
+        y2 += top.yOffset;
+
+        if(y1 > y2) {
+            std::swap(y1, y2);
+        }
+
+        drawVerticalSpan(x, y1, y2);
+    }
+
+    void SFMLGraphics::drawHorizontalSpan(int x1, int x2, int y) {
+        const ClipRectangle& top = mClipStack.top();
+
+        if (y < top.y || y >= top.y + top.height)
+        {
+            GCN_SFML_COUNT(rejectedPrimitives, 1);
+            return;
         }
 
         if (top.x > x1)
         {
             if (top.x > x2)
             {
+                GCN_SFML_COUNT(rejectedPrimitives, 1);
                 return;
             }
 
@@ -314,6 +1846,7 @@ namespace gcn
         {
             if (top.x + top.width <= x1)
             {
+                GCN_SFML_COUNT(rejectedPrimitives, 1);
                 return;
             }
 
@@ -323,46 +1856,26 @@ namespace gcn
         // Overdraw by 1 pixel; Widgets expect this behavior
         x2 += 1;
 
-        float lineX1 = static_cast<float>(x1);
-        float lineX2 = static_cast<float>(x2);
-        float lineY = static_cast<float>(y);
-
-        sf::Vertex rect[4] = 
-        {
-            sf::Vertex(sf::Vector2f(lineX1, lineY), mSfmlColor),
-            sf::Vertex(sf::Vector2f(lineX2, lineY), mSfmlColor),
-            sf::Vertex(sf::Vector2f(lineX2, lineY + 1), mSfmlColor),
-            sf::Vertex(sf::Vector2f(lineX1, lineY + 1), mSfmlColor)
-        };
-
-        mTarget->draw(rect, 4, sf::Quads);
+        addRectangle(static_cast<float>(x1),
+                     static_cast<float>(y),
+                     static_cast<float>(x2 - x1),
+                     1);
     }
 
-    void SFMLGraphics::drawVerticalLine(int x, int y1, int y2) {
-        if (mClipStack.empty())
-        {
-            throw GCN_EXCEPTION("Clip stack is empty, perhaps you called a draw function outside of _beginDraw() and _endDraw()?");
-        }
-
+    void SFMLGraphics::drawVerticalSpan(int x, int y1, int y2) {
         const ClipRectangle& top = mClipStack.top();
 
-        x += top.xOffset;
-        y1 += top.yOffset;
-        y2 += top.yOffset;
-
         if (x < top.x || x >= top.x + top.width)
         {
+            GCN_SFML_COUNT(rejectedPrimitives, 1);
             return;
         }
 
-        if(y1 > y2) {
-            std::swap(y1, y2);
-        }
-
         if (top.y > y1)
         {
             if (top.y > y2)
             {
+                GCN_SFML_COUNT(rejectedPrimitives, 1);
                 return;
             }
 
@@ -373,6 +1886,7 @@ namespace gcn
         {
             if (top.y + top.height <= y1)
             {
+                GCN_SFML_COUNT(rejectedPrimitives, 1);
                 return;
             }
 
@@ -382,19 +1896,10 @@ namespace gcn
         // Overdraw by 1 pixel; Widgets expect this behavior
         y2 += 1;
         
-        float lineX = static_cast<float>(x);
-        float lineY1 = static_cast<float>(y1);
-        float lineY2 = static_cast<float>(y2);
-
-        sf::Vertex rect[4] = 
-        {
-            sf::Vertex(sf::Vector2f(lineX, lineY1), mSfmlColor),
-            sf::Vertex(sf::Vector2f(lineX, lineY2), mSfmlColor),
-            sf::Vertex(sf::Vector2f(lineX + 1, lineY2), mSfmlColor),
-            sf::Vertex(sf::Vector2f(lineX + 1, lineY1), mSfmlColor)
-        };
-
-        mTarget->draw(rect, 4, sf::Quads);
+        addRectangle(static_cast<float>(x),
+                     static_cast<float>(y1),
+                     1,
+                     static_cast<float>(y2 - y1));
     }
 
     void SFMLGraphics::drawBresenham(int x1, int y1, int x2, int y2) {
@@ -413,6 +1918,9 @@ namespace gcn
         int dx = std::abs(x2 - x1);
         int dy = std::abs(y2 - y1);
 
+        // Instead of plotting every pixel, consecutive pixels which share a
+        // row (or column for steep lines) are collected into a run which is
+        // clipped and drawn as a single quad.
         if (dx > dy)
         {
             if (x1 > x2)
@@ -421,48 +1929,30 @@ namespace gcn
                 std::swap(y1, y2);
             }
 
-            if (y1 < y2)
-            {
-                int y = y1;
-                int p = 0;
-
-                for (int x = x1; x <= x2; x++)
-                {
-                    if (top.isContaining(x, y))
-                    {
-                        _drawFauxPixel(x, y);
-                    }
+            const int yStep = y1 < y2 ? 1 : -1;
 
-                    p += dy;
+            int y = y1;
+            int p = 0;
+            int runStart = x1;
 
-                    if (p * 2 >= dx)
-                    {
-                        y++;
-                        p -= dx;
-                    }
-                }
-            }
-            else
+            for (int x = x1; x <= x2; x++)
             {
-                int y = y1;
-                int p = 0;
+                p += dy;
 
-                for (int x = x1; x <= x2; x++)
+                if (p * 2 >= dx)
                 {
-                    if (top.isContaining(x, y))
-                    {
-                        _drawFauxPixel(x, y);
-                    }
+                    drawHorizontalSpan(runStart, x, y);
+                    runStart = x + 1;
 
-                    p += dy;
-
-                    if (p * 2 >= dx)
-                    {
-                        y--;
-                        p -= dx;
-                    }
+                    y += yStep;
+                    p -= dx;
                 }
             }
+
+            if (runStart <= x2)
+            {
+                drawHorizontalSpan(runStart, x2, y);
+            }
         }
         else
         {
@@ -472,48 +1962,30 @@ namespace gcn
                 std::swap(x1, x2);
             }
 
-            if (x1 < x2)
-            {
-                int x = x1;
-                int p = 0;
-
-                for (int y = y1; y <= y2; y++)
-                {
-                    if (top.isContaining(x, y))
-                    {
-                        _drawFauxPixel(x, y);
-                    }
+            const int xStep = x1 < x2 ? 1 : -1;
 
-                    p += dx;
+            int x = x1;
+            int p = 0;
+            int runStart = y1;
 
-                    if (p * 2 >= dy)
-                    {
-                        x++;
-                        p -= dy;
-                    }
-                }
-            }
-            else
+            for (int y = y1; y <= y2; y++)
             {
-                int x = x1;
-                int p = 0;
+                p += dx;
 
-                for (int y = y1; y <= y2; y++)
+                if (p * 2 >= dy)
                 {
-                    if (top.isContaining(x, y))
-                    {
-                        _drawFauxPixel(x, y);
-                    }
+                    drawVerticalSpan(x, runStart, y);
+                    runStart = y + 1;
 
-                    p += dx;
-
-                    if (p * 2 >= dy)
-                    {
-                        x--;
-                        p -= dy;
-                    }
+                    x += xStep;
+                    p -= dy;
                 }
             }
+
+            if (runStart <= y2)
+            {
+                drawVerticalSpan(x, runStart, y2);
+            }
         }
     }
 }
\ No newline at end of file
@@ -1,8 +1,13 @@
 #include "guichan/sfml/sfmlimage.hpp"
 #include "guichan/sfml/sfmlgraphics.hpp"
+#include "guichan/sfml/sfmlimageloader.hpp"
+#include "guichan/sfml/sfmltextureatlas.hpp"
 
 #include "guichan/exception.hpp"
 
+#include <algorithm>
+
+#include <SFML/Graphics/Image.hpp>
 #include <SFML/Graphics/Texture.hpp>
 #include <SFML/System/Vector2.hpp>
 
@@ -11,20 +16,48 @@ namespace gcn
     SFMLImage::SFMLImage(sf::Texture* texture, bool autoFree)
     {
         mAutoFree = autoFree;
+        mSharedTexture = false;
+        mLoader = NULL;
+        mAtlas = NULL;
+        mPending = false;
+        mHasPixelCopy = false;
+        mPixelAccessEnabled = true;
+        mEditing = false;
         mTexture = texture;
 
         if (mTexture != NULL)
         {
-            mImage = mTexture->copyToImage();
+            const sf::Vector2u size = mTexture->getSize();
+            mTextureRect = sf::IntRect(0, 0, size.x, size.y);
         }
     }
 
+    SFMLImage::SFMLImage(sf::Texture* texture, const sf::IntRect& textureRect)
+    {
+        mAutoFree = false;
+        mSharedTexture = true;
+        mLoader = NULL;
+        mAtlas = NULL;
+        mPending = false;
+        mHasPixelCopy = false;
+        mPixelAccessEnabled = true;
+        mEditing = false;
+        mTexture = texture;
+        mTextureRect = textureRect;
+    }
+
     SFMLImage::~SFMLImage()
     {
         if (mAutoFree)
         {
             free();
         }
+        else if (mLoader != NULL)
+        {
+            // The loader keeps track of every image it handed out, whether
+            // the image owns its texture or not.
+            mLoader->releaseImage(this);
+        }
     }
 
     sf::Texture* SFMLImage::getTexture() const
@@ -32,24 +65,242 @@ namespace gcn
         return mTexture;
     }
 
+    const sf::IntRect& SFMLImage::getTextureRect() const
+    {
+        return mTextureRect;
+    }
+
+    bool SFMLImage::isLoaded() const
+    {
+        return mTexture != NULL;
+    }
+
+    bool SFMLImage::isPending() const
+    {
+        return mPending;
+    }
+
+    void SFMLImage::setPixelAccessEnabled(bool pixelAccessEnabled)
+    {
+        mPixelAccessEnabled = pixelAccessEnabled;
+
+        if (!mPixelAccessEnabled)
+        {
+            releasePixelCopy();
+        }
+    }
+
+    bool SFMLImage::isPixelAccessEnabled() const
+    {
+        return mPixelAccessEnabled;
+    }
+
+    void SFMLImage::releasePixelCopy()
+    {
+        if (mHasPixelCopy)
+        {
+            // Changes which haven't reached the texture would be lost.
+            uploadPixelChanges();
+
+            std::vector<sf::Uint8>().swap(mPixels);
+            mHasPixelCopy = false;
+        }
+    }
+
+    bool SFMLImage::releasePixelCopyIfIdle(sf::Time idleTime)
+    {
+        if (!mHasPixelCopy || mEditing || mPixelAccessClock.getElapsedTime() < idleTime)
+        {
+            return false;
+        }
+
+        releasePixelCopy();
+
+        return true;
+    }
+
+    void SFMLImage::beginEdit()
+    {
+        mEditing = true;
+    }
+
+    void SFMLImage::endEdit()
+    {
+        mEditing = false;
+        uploadPixelChanges();
+    }
+
+    bool SFMLImage::hasPendingPixelChanges() const
+    {
+        return !mDirtyRects.empty();
+    }
+
+    void SFMLImage::uploadPixelChanges() const
+    {
+        if (mDirtyRects.empty() || mTexture == NULL)
+        {
+            mDirtyRects.clear();
+            return;
+        }
+
+        const sf::Uint8* pixels = &mPixels[0];
+        const std::size_t stride = static_cast<std::size_t>(mTextureRect.width) * 4;
+        std::vector<sf::Uint8> region;
+
+        for (std::size_t i = 0; i < mDirtyRects.size(); ++i)
+        {
+            const sf::IntRect& rect = mDirtyRects[i];
+            const std::size_t rowBytes = static_cast<std::size_t>(rect.width) * 4;
+            const sf::Uint8* first = pixels + rect.top * stride + rect.left * 4;
+
+            // Full rows are contiguous in the image and can be uploaded in
+            // place, anything narrower is gathered first.
+            if (rowBytes == stride)
+            {
+                mTexture->update(first,
+                                 rect.width,
+                                 rect.height,
+                                 mTextureRect.left + rect.left,
+                                 mTextureRect.top + rect.top);
+                continue;
+            }
+
+            region.resize(rowBytes * rect.height);
+
+            for (int row = 0; row < rect.height; ++row)
+            {
+                std::copy(first + row * stride, first + row * stride + rowBytes, region.begin() + row * rowBytes);
+            }
+
+            mTexture->update(&region[0],
+                             rect.width,
+                             rect.height,
+                             mTextureRect.left + rect.left,
+                             mTextureRect.top + rect.top);
+        }
+
+        mDirtyRects.clear();
+
+        // A shared readback of an atlas page no longer matches the page.
+        if (mAtlas != NULL)
+        {
+            mAtlas->invalidatePagePixels(mTexture);
+        }
+    }
+
+    void SFMLImage::markDirty(const sf::IntRect& area)
+    {
+        const int areaRight = area.left + area.width;
+        const int areaBottom = area.top + area.height;
+
+        std::size_t best = 0;
+        long bestGrowth = -1;
+
+        for (std::size_t i = 0; i < mDirtyRects.size(); ++i)
+        {
+            const sf::IntRect& rect = mDirtyRects[i];
+
+            const int left = std::min(rect.left, area.left);
+            const int top = std::min(rect.top, area.top);
+            const int right = std::max(rect.left + rect.width, areaRight);
+            const int bottom = std::max(rect.top + rect.height, areaBottom);
+
+            const long growth = static_cast<long>(right - left) * (bottom - top)
+                - static_cast<long>(rect.width) * rect.height;
+
+            if (bestGrowth < 0 || growth < bestGrowth)
+            {
+                best = i;
+                bestGrowth = growth;
+            }
+        }
+
+        // Grow an existing region if the area overlaps or touches it, or if
+        // there are already too many regions; otherwise start a new one.
+        const bool adjacent = bestGrowth >= 0
+            && area.left <= mDirtyRects[best].left + mDirtyRects[best].width
+            && areaRight >= mDirtyRects[best].left
+            && area.top <= mDirtyRects[best].top + mDirtyRects[best].height
+            && areaBottom >= mDirtyRects[best].top;
+
+        if (adjacent || mDirtyRects.size() >= MAX_DIRTY_RECTS)
+        {
+            sf::IntRect& rect = mDirtyRects[best];
+
+            const int left = std::min(rect.left, area.left);
+            const int top = std::min(rect.top, area.top);
+            const int right = std::max(rect.left + rect.width, areaRight);
+            const int bottom = std::max(rect.top + rect.height, areaBottom);
+
+            rect = sf::IntRect(left, top, right - left, bottom - top);
+        }
+        else
+        {
+            mDirtyRects.push_back(area);
+        }
+    }
+
+    void SFMLImage::preparePixelAccess()
+    {
+        if (!mPixelAccessEnabled)
+        {
+            throw GCN_EXCEPTION("Pixel access is disabled for this image.");
+        }
+
+        mPixelAccessClock.restart();
+
+        if (mHasPixelCopy)
+        {
+            return;
+        }
+
+        // Atlas pages are read back once for all images on them; reading
+        // back a 1024x1024 page for every small image would be slow.
+        const sf::Image* pagePixels = mAtlas != NULL ? mAtlas->getPagePixels(mTexture) : NULL;
+        sf::Image textureImage;
+
+        if (pagePixels == NULL)
+        {
+            textureImage = mTexture->copyToImage();
+            pagePixels = &textureImage;
+        }
+
+        const sf::Uint8* texturePixels = pagePixels->getPixelsPtr();
+        const std::size_t textureStride = static_cast<std::size_t>(pagePixels->getSize().x) * 4;
+        const std::size_t rowBytes = static_cast<std::size_t>(mTextureRect.width) * 4;
+
+        mPixels.resize(rowBytes * mTextureRect.height);
+
+        for (int row = 0; row < mTextureRect.height; ++row)
+        {
+            const sf::Uint8* source = texturePixels
+                + (mTextureRect.top + row) * textureStride
+                + mTextureRect.left * 4;
+
+            std::copy(source, source + rowBytes, mPixels.begin() + row * rowBytes);
+        }
+
+        mHasPixelCopy = true;
+    }
+
     int SFMLImage::getWidth() const
     {
-        if (mTexture == NULL)
+        if (mTexture == NULL && !mPending)
         {
             throw GCN_EXCEPTION("Trying to get the width of a non loaded image.");
         }
 
-        return mTexture->getSize().x;
+        return mTextureRect.width;
     }
 
     int SFMLImage::getHeight() const
     {
-        if (mTexture == NULL)
+        if (mTexture == NULL && !mPending)
         {
             throw GCN_EXCEPTION("Trying to get the height of a non loaded image.");
         }
 
-        return mTexture->getSize().y;
+        return mTextureRect.height;
     }
 
     Color SFMLImage::getPixel(int x, int y)
@@ -59,12 +310,15 @@ namespace gcn
             throw GCN_EXCEPTION("Trying to get a pixel from a non loaded image.");
         }
 
-        if (x < 0 || x >= static_cast<int>(mImage.getSize().x) || y < 0 || y >= static_cast<int>(mImage.getSize().y))
+        preparePixelAccess();
+
+        if (x < 0 || x >= mTextureRect.width || y < 0 || y >= mTextureRect.height)
         {
             throw GCN_EXCEPTION("Trying to get a pixel from a location outside image bounds.");
         }
 
-        sf::Color sfmlColor = mImage.getPixel(static_cast<unsigned int>(x), static_cast<unsigned int>(y));
+        const sf::Uint8* pixel = &mPixels[(y * mTextureRect.width + x) * 4];
+        sf::Color sfmlColor(pixel[0], pixel[1], pixel[2], pixel[3]);
 
         return SFMLGraphics::convertSFMLColorToGuichanColor(sfmlColor);
     }
@@ -76,16 +330,118 @@ namespace gcn
             throw GCN_EXCEPTION("Trying to put a pixel in a non loaded image.");
         }
 
-        if (x < 0 || x >= static_cast<int>(mImage.getSize().x) || y < 0 || y >= static_cast<int>(mImage.getSize().y))
+        preparePixelAccess();
+
+        if (x < 0 || x >= mTextureRect.width || y < 0 || y >= mTextureRect.height)
         {
             throw GCN_EXCEPTION("Trying to set a pixel from a location outside image bounds.");
         }
 
         sf::Color sfmlColor = SFMLGraphics::convertGuichanColorToSFMLColor(color);
 
-        mImage.setPixel(static_cast<unsigned int>(x), static_cast<unsigned int>(y), sfmlColor);
-        
-        mTexture->update(mImage);
+        sf::Uint8* pixel = &mPixels[(y * mTextureRect.width + x) * 4];
+        pixel[0] = sfmlColor.r;
+        pixel[1] = sfmlColor.g;
+        pixel[2] = sfmlColor.b;
+        pixel[3] = sfmlColor.a;
+
+        // The upload is deferred to endEdit() or the next time the image is drawn.
+        markDirty(sf::IntRect(x, y, 1, 1));
+    }
+
+    void SFMLImage::readPixels(int x, int y, int width, int height, Color* colors)
+    {
+        if (!preparePixelRegion(x, y, width, height))
+        {
+            return;
+        }
+
+        const std::size_t stride = static_cast<std::size_t>(mTextureRect.width) * 4;
+
+        for (int row = 0; row < height; ++row)
+        {
+            SFMLGraphics::convertRGBAToGuichanColors(&mPixels[(y + row) * stride + x * 4],
+                                                     colors + row * width,
+                                                     width);
+        }
+    }
+
+    void SFMLImage::readPixels(int x, int y, int width, int height, sf::Uint8* rgba)
+    {
+        if (!preparePixelRegion(x, y, width, height))
+        {
+            return;
+        }
+
+        const std::size_t stride = static_cast<std::size_t>(mTextureRect.width) * 4;
+        const std::size_t rowBytes = static_cast<std::size_t>(width) * 4;
+
+        for (int row = 0; row < height; ++row)
+        {
+            const sf::Uint8* source = &mPixels[(y + row) * stride + x * 4];
+            std::copy(source, source + rowBytes, rgba + row * rowBytes);
+        }
+    }
+
+    void SFMLImage::writePixels(int x, int y, int width, int height, const Color* colors)
+    {
+        if (!preparePixelRegion(x, y, width, height))
+        {
+            return;
+        }
+
+        const std::size_t stride = static_cast<std::size_t>(mTextureRect.width) * 4;
+
+        for (int row = 0; row < height; ++row)
+        {
+            SFMLGraphics::convertGuichanColorsToRGBA(colors + row * width,
+                                                     &mPixels[(y + row) * stride + x * 4],
+                                                     width);
+        }
+
+        markDirty(sf::IntRect(x, y, width, height));
+    }
+
+    void SFMLImage::writePixels(int x, int y, int width, int height, const sf::Uint8* rgba)
+    {
+        if (!preparePixelRegion(x, y, width, height))
+        {
+            return;
+        }
+
+        const std::size_t stride = static_cast<std::size_t>(mTextureRect.width) * 4;
+        const std::size_t rowBytes = static_cast<std::size_t>(width) * 4;
+
+        for (int row = 0; row < height; ++row)
+        {
+            const sf::Uint8* source = rgba + row * rowBytes;
+            std::copy(source, source + rowBytes, mPixels.begin() + (y + row) * stride + x * 4);
+        }
+
+        markDirty(sf::IntRect(x, y, width, height));
+    }
+
+    bool SFMLImage::preparePixelRegion(int x, int y, int width, int height)
+    {
+        if (mTexture == NULL)
+        {
+            throw GCN_EXCEPTION("Trying to access the pixels of a non loaded image.");
+        }
+
+        if (x < 0 || y < 0 || width < 0 || height < 0
+            || x + width > mTextureRect.width || y + height > mTextureRect.height)
+        {
+            throw GCN_EXCEPTION("Trying to access pixels outside image bounds.");
+        }
+
+        if (width == 0 || height == 0)
+        {
+            return false;
+        }
+
+        preparePixelAccess();
+
+        return true;
     }
 
     void SFMLImage::convertToDisplayFormat()
@@ -100,8 +456,27 @@ namespace gcn
 
     void SFMLImage::free()
     {
-        if(mTexture != NULL) {
+        // Other users of a shared texture should still see the changes.
+        if (mSharedTexture)
+        {
+            uploadPixelChanges();
+        }
+
+        if (mLoader != NULL)
+        {
+            // The texture may be shared through the loader's cache, which
+            // deletes it once its last user is gone, or may still be
+            // loading in the background.
+            mLoader->releaseImage(this);
+            mLoader = NULL;
+        }
+
+        if(mTexture != NULL && !mSharedTexture) {
             delete mTexture;
         }
+
+        mTexture = NULL;
+        mDirtyRects.clear();
+        releasePixelCopy();
     }
 }
@@ -1,23 +1,376 @@
 #include "guichan/sfml/sfmlimage.hpp"
 
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <set>
+#include <vector>
+
+#include <SFML/Graphics/Image.hpp>
 #include <SFML/Graphics/Texture.hpp>
+#include <SFML/System/Lock.hpp>
+#include <SFML/System/Sleep.hpp>
+#include <SFML/System/Thread.hpp>
 
 #include "guichan/exception.hpp"
+#include "guichan/sfml/sfmldiskcache.hpp"
 #include "guichan/sfml/sfmlimageloader.hpp"
+#include "guichan/sfml/sfmlmappedfile.hpp"
+#include "guichan/sfml/sfmltextureatlas.hpp"
+#include "guichan/sfml/sfmltrace.hpp"
+
+namespace
+{
+    unsigned int readBigEndian16(const unsigned char* bytes)
+    {
+        return (bytes[0] << 8) | bytes[1];
+    }
+
+    unsigned int readLittleEndian16(const unsigned char* bytes)
+    {
+        return bytes[0] | (bytes[1] << 8);
+    }
+
+    /**
+     * Walks the segments of a JPEG file up to the start of frame, which
+     * holds the size.
+     */
+    bool readJpegSize(std::ifstream& file, sf::Vector2u& size)
+    {
+        file.seekg(2);
+
+        while (file)
+        {
+            int marker = file.get();
+
+            if (marker != 0xff)
+            {
+                return false;
+            }
+
+            // Any number of fill bytes may precede a marker.
+            while (marker == 0xff)
+            {
+                marker = file.get();
+            }
+
+            // Markers without a payload.
+            if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+            {
+                continue;
+            }
+
+            unsigned char header[7];
+
+            if (!file.read(reinterpret_cast<char*>(header), 2))
+            {
+                return false;
+            }
+
+            const unsigned int length = readBigEndian16(header);
+
+            // SOF0 to SOF15, except DHT, JPG and DAC which share the range.
+            if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+            {
+                if (!file.read(reinterpret_cast<char*>(header + 2), 5))
+                {
+                    return false;
+                }
+
+                size = sf::Vector2u(readBigEndian16(header + 5), readBigEndian16(header + 3));
+
+                return true;
+            }
+
+            // The image data starts without a frame header; not a valid file.
+            if (marker == 0xda || length < 2)
+            {
+                return false;
+            }
+
+            file.seekg(length - 2, std::ios::cur);
+        }
+
+        return false;
+    }
+}
 
 namespace gcn {
+    /**
+     * A file requested with loadAsync() and the images waiting for it.
+     */
+    struct SFMLImageLoader::AsyncJob
+    {
+        std::string filename;
+        std::string key;
+        std::vector<SFMLImage*> images;
+        sf::Image pixels; // Written by a worker
+        bool decoded;     // Guarded by mMutex
+        bool succeeded;   // Guarded by mMutex
+    };
+
+    struct SFMLImageLoader::Worker
+    {
+        Worker(SFMLImageLoader* loader)
+            : loader(loader),
+              thread(&SFMLImageLoader::runWorker, this),
+              running(false)
+        {
+        }
+
+        SFMLImageLoader* loader;
+        sf::Thread thread;
+        bool running; // Guarded by mMutex
+    };
+
+    SFMLImageLoader::SFMLImageLoader()
+        : mAtlas(NULL),
+          mAtlasMaxImageSize(0),
+          mDiskCache(NULL),
+          mCacheEnabled(false),
+          mCacheHits(0),
+          mCacheMisses(0),
+          mCacheResidentBytes(0),
+          mWorkerCount(2),
+          mShuttingDown(false),
+          mPixelAccessEnabled(true),
+          mMemoryMappingEnabled(false)
+    {
+    }
+
+    SFMLImageLoader::~SFMLImageLoader()
+    {
+        stopWorkers();
+
+        for (std::list<AsyncJob*>::iterator it = mAsyncJobs.begin(); it != mAsyncJobs.end(); ++it)
+        {
+            delete *it;
+        }
+
+        for (CacheMap::iterator it = mCache.begin(); it != mCache.end(); ++it)
+        {
+            if (it->second.ownsTexture)
+            {
+                delete it->second.texture;
+            }
+        }
+
+        delete mAtlas;
+        delete mDiskCache;
+    }
+
+    void SFMLImageLoader::stopWorkers()
+    {
+        {
+            sf::Lock lock(mMutex);
+            mShuttingDown = true;
+            mDecodeQueue.clear();
+        }
+
+        for (std::size_t i = 0; i < mWorkers.size(); ++i)
+        {
+            mWorkers[i]->thread.wait();
+            delete mWorkers[i];
+        }
+
+        mWorkers.clear();
+    }
+
+    void SFMLImageLoader::enableAtlas(unsigned int pageSize,
+                                      unsigned int padding,
+                                      unsigned int maxImageSize)
+    {
+        if (mAtlas != NULL)
+        {
+            throw GCN_EXCEPTION("The texture atlas is already enabled.");
+        }
+
+        mAtlas = new SFMLTextureAtlas(pageSize, padding);
+        mAtlasMaxImageSize = maxImageSize;
+    }
+
+    const SFMLTextureAtlas* SFMLImageLoader::getAtlas() const
+    {
+        return mAtlas;
+    }
+
+    void SFMLImageLoader::enableDiskCache(const std::string& directory, std::size_t maxBytes)
+    {
+        if (mDiskCache != NULL)
+        {
+            throw GCN_EXCEPTION("The disk cache is already enabled.");
+        }
+
+        mDiskCache = new SFMLDiskCache(directory, maxBytes);
+    }
+
+    const SFMLDiskCache* SFMLImageLoader::getDiskCache() const
+    {
+        return mDiskCache;
+    }
+
+    void SFMLImageLoader::setCacheEnabled(bool cacheEnabled)
+    {
+        mCacheEnabled = cacheEnabled;
+    }
+
+    bool SFMLImageLoader::isCacheEnabled() const
+    {
+        return mCacheEnabled;
+    }
+
+    unsigned int SFMLImageLoader::getCacheHits() const
+    {
+        return mCacheHits;
+    }
+
+    unsigned int SFMLImageLoader::getCacheMisses() const
+    {
+        return mCacheMisses;
+    }
+
+    std::size_t SFMLImageLoader::getCacheResidentBytes() const
+    {
+        return mCacheResidentBytes;
+    }
+
+    std::string SFMLImageLoader::normalizePath(const std::string& path)
+    {
+        const bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+
+        std::vector<std::string> components;
+        std::string component;
+
+        for (std::size_t i = 0; i <= path.size(); ++i)
+        {
+            if (i < path.size() && path[i] != '/' && path[i] != '\\')
+            {
+                component += path[i];
+                continue;
+            }
+
+            if (component == "..")
+            {
+                if (!components.empty() && components.back() != "..")
+                {
+                    components.pop_back();
+                }
+                else if (!absolute)
+                {
+                    components.push_back(component);
+                }
+            }
+            else if (!component.empty() && component != ".")
+            {
+                components.push_back(component);
+            }
+
+            component.clear();
+        }
+
+        std::string normalized = absolute ? "/" : "";
+
+        for (std::size_t i = 0; i < components.size(); ++i)
+        {
+            if (i > 0)
+            {
+                normalized += '/';
+            }
+
+            normalized += components[i];
+        }
+
+        return normalized;
+    }
+
     Image* SFMLImageLoader::load(const std::string& filename,
                                 bool convertToDisplayFormat)
     {
-        sf::Texture *loadedTexture = loadSFMLTexture(filename);
+        GCN_SFML_TRACE_SCOPE("SFMLImageLoader::load");
 
-        if (loadedTexture == NULL)
+        SFMLImage *image = NULL;
+
+        if (mCacheEnabled)
+        {
+            const std::string key = normalizePath(filename);
+            CacheMap::iterator it = mCache.find(key);
+
+            if (it != mCache.end())
+            {
+                mCacheHits++;
+                it->second.references++;
+
+                image = new SFMLImage(it->second.texture, it->second.textureRect);
+            }
+            else
+            {
+                mCacheMisses++;
+
+                image = loadUncached(filename);
+
+                if (image != NULL)
+                {
+                    // The cache takes over the texture from the image.
+                    CacheEntry entry;
+                    entry.texture = image->mTexture;
+                    entry.textureRect = image->mTextureRect;
+                    entry.ownsTexture = !image->mSharedTexture;
+                    entry.references = 1;
+
+                    mCache[key] = entry;
+                    mCacheResidentBytes += static_cast<std::size_t>(entry.textureRect.width)
+                        * entry.textureRect.height * 4;
+
+                    image->mSharedTexture = true;
+                }
+            }
+
+            if (image != NULL)
+            {
+                image->mAutoFree = true;
+                image->mCacheKey = key;
+            }
+        }
+        else
+        {
+            image = loadUncached(filename);
+        }
+
+        if (image == NULL)
         {
             throw GCN_EXCEPTION(
                     std::string("Unable to load image file: ") + filename);
         }
 
-        Image *image = new SFMLImage(loadedTexture, true);
+        registerImage(image);
+
+        if (convertToDisplayFormat)
+        {
+            image->convertToDisplayFormat();
+        }
+
+        return image;
+    }
+
+    Image* SFMLImageLoader::loadFromMemory(const void* data,
+                                           std::size_t size,
+                                           bool convertToDisplayFormat)
+    {
+        sf::Image pixels;
+
+        if (!pixels.loadFromMemory(data, size))
+        {
+            throw GCN_EXCEPTION("Unable to load image from memory");
+        }
+
+        SFMLImage* image = createImage(pixels);
+
+        if (image == NULL)
+        {
+            throw GCN_EXCEPTION("Unable to create a texture for an image loaded from memory");
+        }
+
+        registerImage(image);
 
         if (convertToDisplayFormat)
         {
@@ -27,11 +380,463 @@ namespace gcn {
         return image;
     }
 
+    void SFMLImageLoader::setMemoryMappingEnabled(bool memoryMappingEnabled)
+    {
+        mMemoryMappingEnabled = memoryMappingEnabled;
+    }
+
+    bool SFMLImageLoader::isMemoryMappingEnabled() const
+    {
+        return mMemoryMappingEnabled;
+    }
+
+    SFMLImage* SFMLImageLoader::loadUncached(const std::string& filename)
+    {
+        SFMLImage *image = NULL;
+
+        if (mAtlas == NULL && mDiskCache == NULL)
+        {
+            sf::Texture *loadedTexture = loadSFMLTexture(filename);
+
+            if (loadedTexture != NULL)
+            {
+                image = new SFMLImage(loadedTexture, true);
+            }
+        }
+        else
+        {
+            sf::Image pixels;
+
+            if (decodeImage(filename, pixels))
+            {
+                image = createImage(pixels);
+            }
+        }
+
+        return image;
+    }
+
+    SFMLImage* SFMLImageLoader::loadAsync(const std::string& filename)
+    {
+        const std::string key = normalizePath(filename);
+
+        if (mCacheEnabled)
+        {
+            CacheMap::iterator it = mCache.find(key);
+
+            if (it != mCache.end())
+            {
+                mCacheHits++;
+                it->second.references++;
+
+                SFMLImage* image = new SFMLImage(it->second.texture, it->second.textureRect);
+                image->mAutoFree = true;
+                image->mCacheKey = key;
+                registerImage(image);
+
+                return image;
+            }
+        }
+
+        SFMLImage* image = new SFMLImage(NULL, true);
+        image->mPending = true;
+        registerImage(image);
+
+        // Widgets lay themselves out with the size of the image before it
+        // is decoded.
+        sf::Vector2u size;
+
+        if (readImageSize(filename, size))
+        {
+            image->mTextureRect = sf::IntRect(0, 0, size.x, size.y);
+        }
+
+        // With the cache enabled, requests for a file which is already on
+        // its way share the job.
+        if (mCacheEnabled)
+        {
+            image->mCacheKey = key;
+
+            for (std::list<AsyncJob*>::iterator it = mAsyncJobs.begin(); it != mAsyncJobs.end(); ++it)
+            {
+                if ((*it)->key == key)
+                {
+                    mCacheHits++;
+                    (*it)->images.push_back(image);
+                    return image;
+                }
+            }
+
+            mCacheMisses++;
+        }
+
+        AsyncJob* job = new AsyncJob();
+        job->filename = filename;
+        job->key = key;
+        job->images.push_back(image);
+        job->decoded = false;
+        job->succeeded = false;
+
+        mAsyncJobs.push_back(job);
+
+        sf::Lock lock(mMutex);
+
+        mDecodeQueue.push_back(job);
+
+        if (mWorkers.empty())
+        {
+            for (unsigned int i = 0; i < mWorkerCount; ++i)
+            {
+                mWorkers.push_back(new Worker(this));
+            }
+        }
+
+        for (std::size_t i = 0; i < mWorkers.size(); ++i)
+        {
+            if (!mWorkers[i]->running)
+            {
+                // The worker has already left its loop, so waiting for it
+                // returns right away.
+                mWorkers[i]->thread.wait();
+                mWorkers[i]->running = true;
+                mWorkers[i]->thread.launch();
+                break;
+            }
+        }
+
+        return image;
+    }
+
+    void SFMLImageLoader::runWorker(Worker* worker)
+    {
+        SFMLImageLoader* loader = worker->loader;
+
+        SFMLTrace::setThreadName("SFMLImageLoader worker");
+
+        while (true)
+        {
+            AsyncJob* job = NULL;
+
+            {
+                sf::Lock lock(loader->mMutex);
+
+                if (loader->mDecodeQueue.empty() || loader->mShuttingDown)
+                {
+                    worker->running = false;
+                    return;
+                }
+
+                job = loader->mDecodeQueue.front();
+                loader->mDecodeQueue.pop_front();
+            }
+
+            // The render thread doesn't touch the pixels before the job is
+            // marked as decoded.
+            const bool succeeded = loader->decodeImage(job->filename, job->pixels);
+
+            sf::Lock lock(loader->mMutex);
+
+            job->succeeded = succeeded;
+            job->decoded = true;
+        }
+    }
+
+    unsigned int SFMLImageLoader::uploadPendingImages(std::size_t byteBudget)
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLImageLoader::uploadPendingImages");
+
+        unsigned int uploaded = 0;
+        std::size_t uploadedBytes = 0;
+
+        std::list<AsyncJob*>::iterator it = mAsyncJobs.begin();
+
+        while (it != mAsyncJobs.end())
+        {
+            AsyncJob* job = *it;
+
+            {
+                sf::Lock lock(mMutex);
+
+                if (!job->decoded)
+                {
+                    ++it;
+                    continue;
+                }
+            }
+
+            const sf::Vector2u size = job->pixels.getSize();
+            const std::size_t bytes = static_cast<std::size_t>(size.x) * size.y * 4;
+
+            if (uploaded > 0 && uploadedBytes + bytes > byteBudget)
+            {
+                break;
+            }
+
+            finishAsyncJob(job);
+
+            uploaded++;
+            uploadedBytes += bytes;
+
+            it = mAsyncJobs.erase(it);
+            delete job;
+        }
+
+        return uploaded;
+    }
+
+    bool SFMLImageLoader::readImageSize(const std::string& filename, sf::Vector2u& size)
+    {
+        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+        unsigned char header[26];
+
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)))
+        {
+            // Small GIF and JPEG files are still handled below.
+            file.clear();
+
+            if (file.gcount() < 10)
+            {
+                return false;
+            }
+        }
+
+        if (header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G')
+        {
+            // The IHDR chunk always comes first.
+            size = sf::Vector2u((readBigEndian16(header + 16) << 16) | readBigEndian16(header + 18),
+                                (readBigEndian16(header + 20) << 16) | readBigEndian16(header + 22));
+            return file.gcount() == sizeof(header);
+        }
+
+        if (header[0] == 'G' && header[1] == 'I' && header[2] == 'F')
+        {
+            size = sf::Vector2u(readLittleEndian16(header + 6), readLittleEndian16(header + 8));
+            return true;
+        }
+
+        if (header[0] == 'B' && header[1] == 'M' && file.gcount() == sizeof(header))
+        {
+            const unsigned int headerSize = readLittleEndian16(header + 14);
+
+            // OS/2 bitmaps have 16-bit dimensions.
+            if (headerSize == 12)
+            {
+                size = sf::Vector2u(readLittleEndian16(header + 18), readLittleEndian16(header + 20));
+                return true;
+            }
+
+            const sf::Int32 width = static_cast<sf::Int32>(readLittleEndian16(header + 18) | (readLittleEndian16(header + 20) << 16));
+            const sf::Int32 height = static_cast<sf::Int32>(readLittleEndian16(header + 22) | (readLittleEndian16(header + 24) << 16));
+
+            // Top-down bitmaps have a negative height.
+            size = sf::Vector2u(width, height < 0 ? -height : height);
+            return true;
+        }
+
+        if (header[0] == 0xff && header[1] == 0xd8)
+        {
+            return readJpegSize(file, size);
+        }
+
+        return false;
+    }
+
+    void SFMLImageLoader::waitForPendingImages()
+    {
+        while (!mAsyncJobs.empty())
+        {
+            if (uploadPendingImages(std::numeric_limits<std::size_t>::max()) == 0)
+            {
+                sf::sleep(sf::milliseconds(1));
+            }
+        }
+    }
+
+    unsigned int SFMLImageLoader::getPendingImageCount() const
+    {
+        return static_cast<unsigned int>(mAsyncJobs.size());
+    }
+
+    void SFMLImageLoader::setWorkerCount(unsigned int workerCount)
+    {
+        if (!mWorkers.empty())
+        {
+            throw GCN_EXCEPTION("The number of workers can't be changed after loading in the background.");
+        }
+
+        mWorkerCount = std::max(workerCount, 1u);
+    }
+
+    void SFMLImageLoader::finishAsyncJob(AsyncJob* job)
+    {
+        for (std::size_t i = 0; i < job->images.size(); ++i)
+        {
+            job->images[i]->mPending = false;
+        }
+
+        // Nobody is waiting for the image anymore, or there is nothing to upload.
+        if (job->images.empty() || !job->succeeded)
+        {
+            return;
+        }
+
+        CacheMap::iterator cached = mCacheEnabled ? mCache.find(job->key) : mCache.end();
+
+        // A synchronous load of the same file may have beaten the job to it.
+        if (cached != mCache.end())
+        {
+            CacheEntry& entry = cached->second;
+            entry.references += static_cast<unsigned int>(job->images.size());
+
+            for (std::size_t i = 0; i < job->images.size(); ++i)
+            {
+                SFMLImage* image = job->images[i];
+                image->mTexture = entry.texture;
+                image->mTextureRect = entry.textureRect;
+                image->mSharedTexture = true;
+            }
+
+            return;
+        }
+
+        SFMLImage* created = createImage(job->pixels);
+
+        if (created == NULL)
+        {
+            return;
+        }
+
+        if (mCacheEnabled)
+        {
+            CacheEntry entry;
+            entry.texture = created->mTexture;
+            entry.textureRect = created->mTextureRect;
+            entry.ownsTexture = !created->mSharedTexture;
+            entry.references = static_cast<unsigned int>(job->images.size());
+
+            mCache[job->key] = entry;
+            mCacheResidentBytes += static_cast<std::size_t>(entry.textureRect.width)
+                * entry.textureRect.height * 4;
+        }
+
+        for (std::size_t i = 0; i < job->images.size(); ++i)
+        {
+            SFMLImage* image = job->images[i];
+            image->mTexture = created->mTexture;
+            image->mTextureRect = created->mTextureRect;
+            image->mSharedTexture = mCacheEnabled || created->mSharedTexture;
+        }
+
+        // The texture now belongs to the waiting images or the cache.
+        created->mTexture = NULL;
+        delete created;
+    }
+
+    void SFMLImageLoader::setPixelAccessEnabled(bool pixelAccessEnabled)
+    {
+        mPixelAccessEnabled = pixelAccessEnabled;
+    }
+
+    bool SFMLImageLoader::isPixelAccessEnabled() const
+    {
+        return mPixelAccessEnabled;
+    }
+
+    unsigned int SFMLImageLoader::releaseIdlePixelCopies(sf::Time idleTime)
+    {
+        unsigned int released = 0;
+
+        for (std::set<SFMLImage*>::iterator it = mImages.begin(); it != mImages.end(); ++it)
+        {
+            if ((*it)->releasePixelCopyIfIdle(idleTime))
+            {
+                released++;
+            }
+        }
+
+        if (mAtlas != NULL)
+        {
+            released += mAtlas->releaseIdlePagePixels(idleTime);
+        }
+
+        return released;
+    }
+
+    void SFMLImageLoader::registerImage(SFMLImage* image)
+    {
+        image->mLoader = this;
+        image->mAtlas = mAtlas;
+        image->mPixelAccessEnabled = mPixelAccessEnabled;
+
+        mImages.insert(image);
+    }
+
+    void SFMLImageLoader::releaseImage(SFMLImage* image)
+    {
+        mImages.erase(image);
+
+        if (image->mPending)
+        {
+            for (std::list<AsyncJob*>::iterator it = mAsyncJobs.begin(); it != mAsyncJobs.end(); ++it)
+            {
+                std::vector<SFMLImage*>& images = (*it)->images;
+                images.erase(std::remove(images.begin(), images.end(), image), images.end());
+            }
+
+            image->mPending = false;
+            return;
+        }
+
+        if (!image->mCacheKey.empty())
+        {
+            releaseCachedTexture(image->mCacheKey);
+        }
+    }
+
+    void SFMLImageLoader::releaseCachedTexture(const std::string& key)
+    {
+        CacheMap::iterator it = mCache.find(key);
+
+        if (it == mCache.end())
+        {
+            return;
+        }
+
+        CacheEntry& entry = it->second;
+
+        if (--entry.references > 0)
+        {
+            return;
+        }
+
+        // Atlas space isn't reclaimed, only standalone textures are deleted.
+        if (entry.ownsTexture)
+        {
+            delete entry.texture;
+        }
+
+        mCacheResidentBytes -= static_cast<std::size_t>(entry.textureRect.width)
+            * entry.textureRect.height * 4;
+
+        mCache.erase(it);
+    }
+
     sf::Texture* SFMLImageLoader::loadSFMLTexture(const std::string& filename)
     {
         sf::Texture *texture = new sf::Texture();
 
-        bool textureLoaded = texture->loadFromFile(filename);
+        bool textureLoaded = false;
+
+        if (mMemoryMappingEnabled)
+        {
+            SFMLMappedFile file;
+            textureLoaded = file.open(filename)
+                            && texture->loadFromMemory(file.getData(), file.getSize());
+        }
+        else
+        {
+            textureLoaded = texture->loadFromFile(filename);
+        }
 
         if(!textureLoaded) {
             delete texture;
@@ -40,4 +845,65 @@ namespace gcn {
 
         return texture;
     }
-}
\ No newline at end of file
+
+    bool SFMLImageLoader::loadSFMLImage(const std::string& filename, sf::Image& image)
+    {
+        if (mMemoryMappingEnabled)
+        {
+            SFMLMappedFile file;
+            return file.open(filename) && image.loadFromMemory(file.getData(), file.getSize());
+        }
+
+        return image.loadFromFile(filename);
+    }
+
+    bool SFMLImageLoader::decodeImage(const std::string& filename, sf::Image& image)
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLImageLoader::decodeImage");
+
+        if (mDiskCache == NULL)
+        {
+            return loadSFMLImage(filename, image);
+        }
+
+        if (mDiskCache->load(filename, image))
+        {
+            return true;
+        }
+
+        if (!loadSFMLImage(filename, image))
+        {
+            return false;
+        }
+
+        mDiskCache->store(filename, image);
+
+        return true;
+    }
+
+    SFMLImage* SFMLImageLoader::createImage(const sf::Image& pixels)
+    {
+        const sf::Vector2u size = pixels.getSize();
+
+        if (mAtlas != NULL && size.x <= mAtlasMaxImageSize && size.y <= mAtlasMaxImageSize)
+        {
+            sf::IntRect textureRect;
+            sf::Texture* page = mAtlas->insert(pixels, textureRect);
+
+            if (page != NULL)
+            {
+                return new SFMLImage(page, textureRect);
+            }
+        }
+
+        sf::Texture *texture = new sf::Texture();
+
+        if (!texture->loadFromImage(pixels))
+        {
+            delete texture;
+            return NULL;
+        }
+
+        return new SFMLImage(texture, true);
+    }
+}
@@ -3,6 +3,7 @@
 #include <SFML/Graphics/RenderTarget.hpp>
 
 #include "guichan/exception.hpp"
+#include "guichan/sfml/sfmltrace.hpp"
 
 namespace gcn
 {
@@ -54,6 +55,8 @@ namespace gcn
 
     void SFMLInput::pushInput(const sf::Event& event, const sf::RenderTarget& target)
     {
+        GCN_SFML_TRACE_SCOPE("SFMLInput::pushInput");
+
         KeyInput keyInput;
         MouseInput mouseInput;
 
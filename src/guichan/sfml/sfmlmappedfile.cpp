@@ -0,0 +1,176 @@
+#include "guichan/sfml/sfmlmappedfile.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "guichan/exception.hpp"
+
+namespace gcn
+{
+    SFMLMappedFile::SFMLMappedFile()
+        : mData(NULL),
+          mSize(0)
+#ifdef _WIN32
+          , mFile(NULL),
+          mMapping(NULL)
+#endif
+    {
+    }
+
+    SFMLMappedFile::SFMLMappedFile(const std::string& filename)
+        : mData(NULL),
+          mSize(0)
+#ifdef _WIN32
+          , mFile(NULL),
+          mMapping(NULL)
+#endif
+    {
+        if (!open(filename))
+        {
+            throw GCN_EXCEPTION("Unable to map file \"" + filename + "\"");
+        }
+    }
+
+    SFMLMappedFile::~SFMLMappedFile()
+    {
+        close();
+    }
+
+#ifdef _WIN32
+    bool SFMLMappedFile::open(const std::string& filename)
+    {
+        close();
+
+        HANDLE file = CreateFileA(filename.c_str(),
+                                  GENERIC_READ,
+                                  FILE_SHARE_READ,
+                                  NULL,
+                                  OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL,
+                                  NULL);
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (mapping == NULL)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+        if (data == NULL)
+        {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+
+        mFile = file;
+        mMapping = mapping;
+        mData = data;
+        mSize = static_cast<std::size_t>(size.QuadPart);
+
+        return true;
+    }
+
+    void SFMLMappedFile::close()
+    {
+        if (mData != NULL)
+        {
+            UnmapViewOfFile(mData);
+            CloseHandle(static_cast<HANDLE>(mMapping));
+            CloseHandle(static_cast<HANDLE>(mFile));
+        }
+
+        mData = NULL;
+        mSize = 0;
+        mFile = NULL;
+        mMapping = NULL;
+    }
+#else
+    bool SFMLMappedFile::open(const std::string& filename)
+    {
+        close();
+
+        const int file = ::open(filename.c_str(), O_RDONLY);
+
+        if (file < 0)
+        {
+            return false;
+        }
+
+        struct stat status;
+
+        if (fstat(file, &status) != 0 || status.st_size <= 0)
+        {
+            ::close(file);
+            return false;
+        }
+
+        const std::size_t size = static_cast<std::size_t>(status.st_size);
+        void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+
+        // The mapping stays valid after the descriptor is closed.
+        ::close(file);
+
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        mData = data;
+        mSize = size;
+
+        return true;
+    }
+
+    void SFMLMappedFile::close()
+    {
+        if (mData != NULL)
+        {
+            munmap(const_cast<void*>(mData), mSize);
+        }
+
+        mData = NULL;
+        mSize = 0;
+    }
+#endif
+
+    bool SFMLMappedFile::isOpen() const
+    {
+        return mData != NULL;
+    }
+
+    const void* SFMLMappedFile::getData() const
+    {
+        return mData;
+    }
+
+    std::size_t SFMLMappedFile::getSize() const
+    {
+        return mSize;
+    }
+}
@@ -0,0 +1,96 @@
+#include "guichan/sfml/sfmlpackimageloader.hpp"
+
+#include <SFML/Graphics/Image.hpp>
+#include <SFML/Graphics/Texture.hpp>
+
+namespace gcn
+{
+    SFMLPackImageLoader::SFMLPackImageLoader(const std::string& packFilename)
+        : mPack(packFilename),
+          mFallbackEnabled(true)
+    {
+    }
+
+    SFMLPackImageLoader::~SFMLPackImageLoader()
+    {
+        // The workers read the pack, which is gone before the base class
+        // destructor runs.
+        stopWorkers();
+    }
+
+    void SFMLPackImageLoader::setFallbackEnabled(bool fallbackEnabled)
+    {
+        mFallbackEnabled = fallbackEnabled;
+    }
+
+    bool SFMLPackImageLoader::isFallbackEnabled() const
+    {
+        return mFallbackEnabled;
+    }
+
+    const SFMLAssetPack& SFMLPackImageLoader::getPack() const
+    {
+        return mPack;
+    }
+
+    sf::Texture* SFMLPackImageLoader::loadSFMLTexture(const std::string& filename)
+    {
+        const SFMLAssetPack::Entry* entry = mPack.find(normalizePath(filename));
+
+        if (entry == NULL)
+        {
+            return mFallbackEnabled ? SFMLImageLoader::loadSFMLTexture(filename) : NULL;
+        }
+
+        sf::Texture* texture = new sf::Texture();
+
+        if (entry->compression == SFMLAssetPack::None)
+        {
+            // Straight from the mapping to the graphics card.
+            if (texture->create(entry->width, entry->height))
+            {
+                texture->update(entry->data);
+                return texture;
+            }
+        }
+        else
+        {
+            sf::Image pixels;
+
+            if (mPack.decode(*entry, pixels) && texture->loadFromImage(pixels))
+            {
+                return texture;
+            }
+        }
+
+        delete texture;
+        return NULL;
+    }
+
+    bool SFMLPackImageLoader::loadSFMLImage(const std::string& filename, sf::Image& image)
+    {
+        // The pack is only read, so this is safe on the worker threads.
+        const SFMLAssetPack::Entry* entry = mPack.find(normalizePath(filename));
+
+        if (entry == NULL)
+        {
+            return mFallbackEnabled && SFMLImageLoader::loadSFMLImage(filename, image);
+        }
+
+        return mPack.decode(*entry, image);
+    }
+
+    bool SFMLPackImageLoader::readImageSize(const std::string& filename, sf::Vector2u& size)
+    {
+        const SFMLAssetPack::Entry* entry = mPack.find(normalizePath(filename));
+
+        if (entry == NULL)
+        {
+            return mFallbackEnabled && SFMLImageLoader::readImageSize(filename, size);
+        }
+
+        size = sf::Vector2u(entry->width, entry->height);
+
+        return true;
+    }
+}
@@ -0,0 +1,414 @@
+#include "guichan/sfml/sfmlrenderthread.hpp"
+
+#include "guichan/exception.hpp"
+#include "guichan/rectangle.hpp"
+#include "guichan/sfml/sfmlcommandlist.hpp"
+#include "guichan/sfml/sfmltrace.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <vector>
+
+#include <SFML/Graphics/RenderWindow.hpp>
+#include <SFML/System/Clock.hpp>
+
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace gcn
+{
+    /**
+     * The Graphics handed to the GUI. It records every frame into a list
+     * of the render thread instead of drawing it.
+     */
+    class SFMLRenderThread::Recorder : public SFMLGraphics
+    {
+    public:
+        Recorder(SFMLRenderThread& renderThread)
+            : SFMLGraphics(renderThread.mWindow),
+              mRenderThread(renderThread)
+        {
+        }
+
+        virtual void _beginDraw()
+        {
+            GCN_SFML_TRACE_SCOPE("SFMLRenderThread::Recorder::_beginDraw");
+
+            // The window belongs to the render thread, so its view isn't
+            // read here.
+            mContextView = mRenderThread.mView;
+            mSize = mContextView.getSize();
+
+            mRecordingList = mRenderThread.acquireCommandList();
+            mRecordingList->clear();
+            mRecordingList->setBlendMode(mBlendMode);
+
+            Graphics::pushClipArea(Rectangle(0, 0, static_cast<int>(mSize.x), static_cast<int>(mSize.y)));
+        }
+
+        virtual void _endDraw()
+        {
+            GCN_SFML_TRACE_SCOPE("SFMLRenderThread::Recorder::_endDraw");
+
+            Graphics::popClipArea();
+
+            SFMLCommandList* list = mRecordingList;
+            mRecordingList = NULL;
+
+            mRenderThread.submit(list);
+        }
+
+    private:
+        SFMLRenderThread& mRenderThread;
+    };
+
+    struct SFMLRenderThread::Pipeline
+    {
+        Pipeline()
+            : stopping(false),
+              rendering(false)
+        {
+            statistics.submittedFrames = 0;
+            statistics.renderedFrames = 0;
+            statistics.droppedFrames = 0;
+        }
+
+        std::vector<SFMLCommandList*> lists; // All lists, owned
+        std::vector<SFMLCommandList*> unusedLists;
+        std::deque<Frame> queue; // Frames waiting for the render thread
+        Statistics statistics;
+        bool stopping; // Set to make the render thread finish
+        bool rendering; // True while the render thread draws a frame
+        std::string error; // Message of an exception thrown while drawing
+
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        std::mutex mutex; // Guards everything above
+        std::condition_variable queued; // Signalled when a frame was queued or stopping was set
+        std::condition_variable consumed; // Signalled when a frame left the queue or was drawn
+        std::thread thread;
+#endif
+    };
+
+    SFMLRenderThread::SFMLRenderThread(sf::RenderWindow& window)
+        : mWindow(window),
+          mGraphics(window),
+          mRecorder(NULL),
+          mPipeline(new Pipeline()),
+          mView(window.getView()),
+          mClearColor(sf::Color::Black),
+          mMaxQueuedFrames(1),
+          mDroppingStaleFrames(false)
+    {
+        mRecorder = new Recorder(*this);
+
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        // A context can only be active on one thread at a time.
+        mWindow.setActive(false);
+        mPipeline->thread = std::thread(&SFMLRenderThread::run, this);
+#endif
+    }
+
+    SFMLRenderThread::~SFMLRenderThread()
+    {
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        {
+            std::lock_guard<std::mutex> lock(mPipeline->mutex);
+            mPipeline->stopping = true;
+        }
+
+        mPipeline->queued.notify_one();
+        mPipeline->thread.join();
+
+        mWindow.setActive(true);
+#endif
+
+        for (std::size_t i = 0; i < mPipeline->lists.size(); ++i)
+        {
+            delete mPipeline->lists[i];
+        }
+
+        delete mPipeline;
+        delete mRecorder;
+    }
+
+    SFMLGraphics& SFMLRenderThread::getGraphics()
+    {
+        return *mRecorder;
+    }
+
+    void SFMLRenderThread::setView(const sf::View& view)
+    {
+        mView = view;
+    }
+
+    const sf::View& SFMLRenderThread::getView() const
+    {
+        return mView;
+    }
+
+    void SFMLRenderThread::setClearColor(const sf::Color& color)
+    {
+        mClearColor = color;
+    }
+
+    const sf::Color& SFMLRenderThread::getClearColor() const
+    {
+        return mClearColor;
+    }
+
+    void SFMLRenderThread::setMaxQueuedFrames(unsigned int frames)
+    {
+        mMaxQueuedFrames = std::max(frames, 1u);
+    }
+
+    unsigned int SFMLRenderThread::getMaxQueuedFrames() const
+    {
+        return mMaxQueuedFrames;
+    }
+
+    void SFMLRenderThread::setDroppingStaleFrames(bool droppingStaleFrames)
+    {
+        mDroppingStaleFrames = droppingStaleFrames;
+    }
+
+    bool SFMLRenderThread::isDroppingStaleFrames() const
+    {
+        return mDroppingStaleFrames;
+    }
+
+    void SFMLRenderThread::waitUntilIdle()
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLRenderThread::waitUntilIdle");
+
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        std::unique_lock<std::mutex> lock(mPipeline->mutex);
+
+        while (!mPipeline->queue.empty() || mPipeline->rendering)
+        {
+            mPipeline->consumed.wait(lock);
+        }
+
+        lock.unlock();
+#endif
+
+        checkError();
+    }
+
+    SFMLRenderThread::Statistics SFMLRenderThread::getStatistics() const
+    {
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        std::lock_guard<std::mutex> lock(mPipeline->mutex);
+#endif
+
+        return mPipeline->statistics;
+    }
+
+    SFMLCommandList* SFMLRenderThread::acquireCommandList()
+    {
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        std::lock_guard<std::mutex> lock(mPipeline->mutex);
+#endif
+
+        // At most one list is recorded, one drawn and the rest queued, so
+        // the number of lists stays bounded by the queue length.
+        if (mPipeline->unusedLists.empty())
+        {
+            mPipeline->lists.push_back(new SFMLCommandList());
+            return mPipeline->lists.back();
+        }
+
+        SFMLCommandList* list = mPipeline->unusedLists.back();
+        mPipeline->unusedLists.pop_back();
+
+        return list;
+    }
+
+    void SFMLRenderThread::submit(SFMLCommandList* list)
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLRenderThread::submit");
+
+        Frame frame;
+        frame.list = list;
+        frame.view = mView;
+        frame.clearColor = mClearColor;
+
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        {
+            std::unique_lock<std::mutex> lock(mPipeline->mutex);
+
+            if (mDroppingStaleFrames)
+            {
+                // Frames not yet started are out of date by now.
+                while (!mPipeline->queue.empty())
+                {
+                    mPipeline->unusedLists.push_back(mPipeline->queue.front().list);
+                    mPipeline->queue.pop_front();
+                    mPipeline->statistics.droppedFrames++;
+                }
+            }
+            else if (mPipeline->queue.size() >= mMaxQueuedFrames)
+            {
+                GCN_SFML_TRACE_SCOPE("SFMLRenderThread::stall");
+                sf::Clock clock;
+
+                while (mPipeline->queue.size() >= mMaxQueuedFrames && mPipeline->error.empty())
+                {
+                    mPipeline->consumed.wait(lock);
+                }
+
+                mPipeline->statistics.stallTime += clock.getElapsedTime();
+            }
+
+            mPipeline->queue.push_back(frame);
+            mPipeline->statistics.submittedFrames++;
+        }
+
+        mPipeline->queued.notify_one();
+#else
+        mPipeline->statistics.submittedFrames++;
+
+        try
+        {
+            renderFrame(frame);
+        }
+        catch (const Exception& e)
+        {
+            mPipeline->error = e.getMessage();
+        }
+        catch (const std::exception& e)
+        {
+            mPipeline->error = e.what();
+        }
+        catch (...)
+        {
+            mPipeline->error = "Unknown error";
+        }
+
+        mPipeline->unusedLists.push_back(list);
+        mPipeline->statistics.renderedFrames++;
+#endif
+
+        checkError();
+    }
+
+    void SFMLRenderThread::run()
+    {
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+        SFMLTrace::setThreadName("SFMLRenderThread");
+
+        mWindow.setActive(true);
+
+        while (true)
+        {
+            Frame frame;
+
+            {
+                std::unique_lock<std::mutex> lock(mPipeline->mutex);
+
+                while (mPipeline->queue.empty() && !mPipeline->stopping)
+                {
+                    mPipeline->queued.wait(lock);
+                }
+
+                // Frames still queued are drawn before stopping.
+                if (mPipeline->queue.empty())
+                {
+                    break;
+                }
+
+                frame = mPipeline->queue.front();
+                mPipeline->queue.pop_front();
+                mPipeline->rendering = true;
+            }
+
+            // The GUI thread may record into the freed queue slot already.
+            mPipeline->consumed.notify_all();
+
+            std::string error;
+
+            try
+            {
+                renderFrame(frame);
+            }
+            catch (const Exception& e)
+            {
+                error = e.getMessage();
+            }
+            catch (const std::exception& e)
+            {
+                // Anything escaping the thread would terminate the program.
+                error = e.what();
+            }
+            catch (...)
+            {
+                error = "Unknown error";
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mPipeline->mutex);
+
+                mPipeline->unusedLists.push_back(frame.list);
+                mPipeline->statistics.renderedFrames++;
+                mPipeline->rendering = false;
+
+                if (mPipeline->error.empty())
+                {
+                    mPipeline->error = error;
+                }
+            }
+
+            mPipeline->consumed.notify_all();
+        }
+
+        mWindow.setActive(false);
+#endif
+    }
+
+    void SFMLRenderThread::renderFrame(const Frame& frame)
+    {
+        GCN_SFML_TRACE_SCOPE("SFMLRenderThread::renderFrame");
+
+        mWindow.setView(frame.view);
+        mWindow.clear(frame.clearColor);
+
+        const Color color = mGraphics.getColor();
+
+        try
+        {
+            mGraphics._beginDraw();
+            mGraphics.drawCommandList(*frame.list);
+            mGraphics._endDraw();
+        }
+        catch (...)
+        {
+            // A failed frame must not leave its clip areas and batch to
+            // the frames after it.
+            mGraphics.abortFrame();
+            mGraphics.setColor(color);
+            throw;
+        }
+
+        mWindow.display();
+    }
+
+    void SFMLRenderThread::checkError()
+    {
+        std::string error;
+
+        {
+#ifdef GCN_SFML_ENABLE_RENDER_THREAD
+            std::lock_guard<std::mutex> lock(mPipeline->mutex);
+#endif
+            error.swap(mPipeline->error);
+        }
+
+        if (!error.empty())
+        {
+            throw GCN_EXCEPTION("Drawing a frame failed: " + error);
+        }
+    }
+}
@@ -0,0 +1,233 @@
+#include "guichan/sfml/sfmltextureatlas.hpp"
+
+#include <SFML/Graphics/Image.hpp>
+#include <SFML/Graphics/Texture.hpp>
+
+#include "guichan/exception.hpp"
+
+namespace gcn
+{
+    SFMLTextureAtlas::SFMLTextureAtlas(unsigned int pageSize, unsigned int padding)
+        : mPageSize(pageSize),
+          mPadding(padding),
+          mUsedArea(0)
+    {
+        if (mPageSize > sf::Texture::getMaximumSize())
+        {
+            mPageSize = sf::Texture::getMaximumSize();
+        }
+    }
+
+    SFMLTextureAtlas::~SFMLTextureAtlas()
+    {
+        for (std::size_t i = 0; i < mPages.size(); ++i)
+        {
+            delete mPages[i].texture;
+            delete mPages[i].pixels;
+        }
+    }
+
+    sf::Texture* SFMLTextureAtlas::insert(const sf::Image& image, sf::IntRect& rectangle)
+    {
+        const sf::Vector2u size = image.getSize();
+
+        if (size.x + 2 * mPadding > mPageSize || size.y + 2 * mPadding > mPageSize)
+        {
+            return NULL;
+        }
+
+        sf::Vector2u position;
+        Page* page = NULL;
+
+        for (std::size_t i = 0; i < mPages.size(); ++i)
+        {
+            if (allocate(mPages[i], size.x, size.y, position))
+            {
+                page = &mPages[i];
+                break;
+            }
+        }
+
+        if (page == NULL)
+        {
+            Page newPage;
+            newPage.texture = new sf::Texture();
+            newPage.height = 0;
+            newPage.pixels = NULL;
+
+            if (!newPage.texture->create(mPageSize, mPageSize))
+            {
+                delete newPage.texture;
+                throw GCN_EXCEPTION("Unable to create a texture atlas page.");
+            }
+
+            // A new texture holds whatever was in video memory, which would
+            // show through the padding when images are drawn smoothed or
+            // scaled.
+            sf::Image transparent;
+            transparent.create(mPageSize, mPageSize, sf::Color::Transparent);
+            newPage.texture->update(transparent);
+
+            mPages.push_back(newPage);
+            page = &mPages.back();
+
+            allocate(*page, size.x, size.y, position);
+        }
+
+        page->texture->update(image, position.x, position.y);
+
+        // A copy read back earlier is kept up to date rather than read again.
+        if (page->pixels != NULL)
+        {
+            page->pixels->copy(image, position.x, position.y);
+        }
+
+        rectangle = sf::IntRect(position.x, position.y, size.x, size.y);
+        mUsedArea += static_cast<std::size_t>(size.x) * size.y;
+
+        return page->texture;
+    }
+
+    bool SFMLTextureAtlas::allocate(Page& page, unsigned int width, unsigned int height, sf::Vector2u& position)
+    {
+        // The padding goes on all sides, so no image touches another one
+        // or the edge of the page.
+        const unsigned int paddedWidth = width + 2 * mPadding;
+        const unsigned int paddedHeight = height + 2 * mPadding;
+
+        // Pick the lowest shelf the image fits on to waste as little
+        // vertical space as possible.
+        Shelf* best = NULL;
+
+        for (std::size_t i = 0; i < page.shelves.size(); ++i)
+        {
+            Shelf& shelf = page.shelves[i];
+
+            if (shelf.height >= paddedHeight
+                && shelf.width + paddedWidth <= mPageSize
+                && (best == NULL || shelf.height < best->height))
+            {
+                best = &shelf;
+            }
+        }
+
+        if (best == NULL)
+        {
+            if (page.height + paddedHeight > mPageSize)
+            {
+                return false;
+            }
+
+            Shelf shelf;
+            shelf.y = page.height;
+            shelf.height = paddedHeight;
+            shelf.width = 0;
+
+            page.shelves.push_back(shelf);
+            page.height += paddedHeight;
+
+            best = &page.shelves.back();
+        }
+
+        position.x = best->width + mPadding;
+        position.y = best->y + mPadding;
+
+        best->width += paddedWidth;
+
+        return true;
+    }
+
+    unsigned int SFMLTextureAtlas::getPageSize() const
+    {
+        return mPageSize;
+    }
+
+    unsigned int SFMLTextureAtlas::getPadding() const
+    {
+        return mPadding;
+    }
+
+    unsigned int SFMLTextureAtlas::getPageCount() const
+    {
+        return static_cast<unsigned int>(mPages.size());
+    }
+
+    std::size_t SFMLTextureAtlas::getUsedArea() const
+    {
+        return mUsedArea;
+    }
+
+    float SFMLTextureAtlas::getUtilization() const
+    {
+        if (mPages.empty())
+        {
+            return 0.0f;
+        }
+
+        const double pageArea = static_cast<double>(mPageSize) * mPageSize;
+
+        return static_cast<float>(mUsedArea / (pageArea * mPages.size()));
+    }
+
+    const sf::Image* SFMLTextureAtlas::getPagePixels(const sf::Texture* texture)
+    {
+        Page* page = findPage(texture);
+
+        if (page == NULL)
+        {
+            return NULL;
+        }
+
+        if (page->pixels == NULL)
+        {
+            page->pixels = new sf::Image(page->texture->copyToImage());
+        }
+
+        page->pixelsClock.restart();
+
+        return page->pixels;
+    }
+
+    void SFMLTextureAtlas::invalidatePagePixels(const sf::Texture* texture)
+    {
+        Page* page = findPage(texture);
+
+        if (page != NULL)
+        {
+            delete page->pixels;
+            page->pixels = NULL;
+        }
+    }
+
+    unsigned int SFMLTextureAtlas::releaseIdlePagePixels(sf::Time idleTime)
+    {
+        unsigned int released = 0;
+
+        for (std::size_t i = 0; i < mPages.size(); ++i)
+        {
+            Page& page = mPages[i];
+
+            if (page.pixels != NULL && page.pixelsClock.getElapsedTime() >= idleTime)
+            {
+                delete page.pixels;
+                page.pixels = NULL;
+                released++;
+            }
+        }
+
+        return released;
+    }
+
+    SFMLTextureAtlas::Page* SFMLTextureAtlas::findPage(const sf::Texture* texture)
+    {
+        for (std::size_t i = 0; i < mPages.size(); ++i)
+        {
+            if (mPages[i].texture == texture)
+            {
+                return &mPages[i];
+            }
+        }
+
+        return NULL;
+    }
+}
@@ -0,0 +1,304 @@
+#include "guichan/sfml/sfmltrace.hpp"
+
+#include <cstdio>
+
+#ifdef GCN_SFML_ENABLE_TRACING
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    /**
+     * A recorded span. The fields are atomic only so that
+     * writeChromeTrace() may read them while the owning thread writes.
+     */
+    struct Span
+    {
+        std::atomic<const char*> name;
+        std::atomic<sf::Int64> start;
+        std::atomic<sf::Int64> duration;
+    };
+
+    /**
+     * The spans of one thread. Only the owning thread writes spans. Before
+     * overwriting a slot it bumps reserved, and after writing it bumps
+     * committed, so readers can tell which spans they may have read while
+     * they were being overwritten.
+     */
+    struct ThreadRing
+    {
+        ThreadRing(unsigned int id)
+            : reserved(0),
+              committed(0),
+              cleared(0),
+              id(id)
+        {
+        }
+
+        Span spans[gcn::SFMLTrace::RING_SIZE];
+        std::atomic<std::uint64_t> reserved;
+        std::atomic<std::uint64_t> committed;
+        std::atomic<std::uint64_t> cleared; // Spans before this were cleared
+        unsigned int id;
+        std::string name; // Guarded by the mutex of the registry
+    };
+
+    /**
+     * The rings of all threads which ever recorded a span. Rings outlive
+     * their threads so their spans can still be written.
+     */
+    struct Registry
+    {
+        Registry()
+            : enabled(true),
+              epoch(std::chrono::steady_clock::now())
+        {
+        }
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadRing> > rings;
+        std::atomic<bool> enabled;
+        const std::chrono::steady_clock::time_point epoch;
+    };
+
+    Registry& getRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    thread_local ThreadRing* threadRing = nullptr;
+
+    ThreadRing& getThreadRing()
+    {
+        if (threadRing == nullptr)
+        {
+            Registry& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            registry.rings.emplace_back(new ThreadRing(static_cast<unsigned int>(registry.rings.size() + 1)));
+            threadRing = registry.rings.back().get();
+        }
+
+        return *threadRing;
+    }
+
+    void writeEscaped(std::FILE* file, const char* text)
+    {
+        for (; *text != '\0'; ++text)
+        {
+            const unsigned char c = static_cast<unsigned char>(*text);
+
+            if (c == '"' || c == '\\')
+            {
+                std::fprintf(file, "\\%c", c);
+            }
+            else if (c < 0x20)
+            {
+                std::fprintf(file, "\\u%04x", c);
+            }
+            else
+            {
+                std::fputc(c, file);
+            }
+        }
+    }
+}
+#endif
+
+namespace gcn
+{
+#ifdef GCN_SFML_ENABLE_TRACING
+    void SFMLTrace::setEnabled(bool enabled)
+    {
+        getRegistry().enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool SFMLTrace::isEnabled()
+    {
+        return getRegistry().enabled.load(std::memory_order_relaxed);
+    }
+
+    void SFMLTrace::setThreadName(const std::string& name)
+    {
+        ThreadRing& ring = getThreadRing();
+
+        std::lock_guard<std::mutex> lock(getRegistry().mutex);
+        ring.name = name;
+    }
+
+    bool SFMLTrace::writeChromeTrace(const std::string& filename)
+    {
+        std::FILE* file = std::fopen(filename.c_str(), "w");
+
+        if (file == NULL)
+        {
+            return false;
+        }
+
+        Registry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+        bool first = true;
+        std::vector<const char*> names;
+        std::vector<sf::Int64> starts;
+        std::vector<sf::Int64> durations;
+
+        for (std::size_t i = 0; i < registry.rings.size(); ++i)
+        {
+            ThreadRing& ring = *registry.rings[i];
+
+            if (!ring.name.empty())
+            {
+                std::fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"",
+                             first ? "" : ",", ring.id);
+                writeEscaped(file, ring.name.c_str());
+                std::fprintf(file, "\"}}");
+                first = false;
+            }
+
+            // Copy the spans first, then drop those which may have been
+            // overwritten during the copy.
+            const std::uint64_t committed = ring.committed.load(std::memory_order_acquire);
+            std::uint64_t begin = committed > RING_SIZE ? committed - RING_SIZE : 0;
+            begin = std::max(begin, ring.cleared.load(std::memory_order_relaxed));
+
+            names.clear();
+            starts.clear();
+            durations.clear();
+
+            for (std::uint64_t index = begin; index < committed; ++index)
+            {
+                const Span& span = ring.spans[index % RING_SIZE];
+
+                names.push_back(span.name.load(std::memory_order_relaxed));
+                starts.push_back(span.start.load(std::memory_order_relaxed));
+                durations.push_back(span.duration.load(std::memory_order_relaxed));
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            const std::uint64_t reserved = ring.reserved.load(std::memory_order_relaxed);
+            const std::uint64_t valid = reserved > RING_SIZE ? reserved - RING_SIZE : 0;
+
+            for (std::uint64_t index = std::max(begin, valid); index < committed; ++index)
+            {
+                const std::size_t span = static_cast<std::size_t>(index - begin);
+
+                std::fprintf(file, "%s\n{\"name\":\"", first ? "" : ",");
+                writeEscaped(file, names[span]);
+                std::fprintf(file, "\",\"cat\":\"guichan\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                             ring.id,
+                             starts[span] / 1000.0,
+                             durations[span] / 1000.0);
+                first = false;
+            }
+        }
+
+        std::fprintf(file, "\n]}\n");
+
+        const bool written = std::ferror(file) == 0;
+
+        return std::fclose(file) == 0 && written;
+    }
+
+    void SFMLTrace::clear()
+    {
+        Registry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        for (std::size_t i = 0; i < registry.rings.size(); ++i)
+        {
+            ThreadRing& ring = *registry.rings[i];
+            ring.cleared.store(ring.committed.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+    }
+
+    sf::Int64 SFMLTrace::now()
+    {
+        const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - getRegistry().epoch;
+
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+    void SFMLTrace::record(const char* name, sf::Int64 start, sf::Int64 end)
+    {
+        ThreadRing& ring = getThreadRing();
+
+        const std::uint64_t index = ring.committed.load(std::memory_order_relaxed);
+        Span& span = ring.spans[index % RING_SIZE];
+
+        ring.reserved.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        span.name.store(name, std::memory_order_relaxed);
+        span.start.store(start, std::memory_order_relaxed);
+        span.duration.store(end - start, std::memory_order_relaxed);
+
+        ring.committed.store(index + 1, std::memory_order_release);
+    }
+#else
+    void SFMLTrace::setEnabled(bool)
+    {
+    }
+
+    bool SFMLTrace::isEnabled()
+    {
+        return false;
+    }
+
+    void SFMLTrace::setThreadName(const std::string&)
+    {
+    }
+
+    bool SFMLTrace::writeChromeTrace(const std::string& filename)
+    {
+        std::FILE* file = std::fopen(filename.c_str(), "w");
+
+        if (file == NULL)
+        {
+            return false;
+        }
+
+        std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[]}\n");
+
+        const bool written = std::ferror(file) == 0;
+
+        return std::fclose(file) == 0 && written;
+    }
+
+    void SFMLTrace::clear()
+    {
+    }
+
+    sf::Int64 SFMLTrace::now()
+    {
+        return 0;
+    }
+
+    void SFMLTrace::record(const char*, sf::Int64, sf::Int64)
+    {
+    }
+#endif
+
+    SFMLTraceScope::SFMLTraceScope(const char* name)
+        : mName(name),
+          mStart(SFMLTrace::isEnabled() ? SFMLTrace::now() : -1)
+    {
+    }
+
+    SFMLTraceScope::~SFMLTraceScope()
+    {
+        if (mStart >= 0)
+        {
+            SFMLTrace::record(mName, mStart, SFMLTrace::now());
+        }
+    }
+}
@@ -0,0 +1,217 @@
+/**
+ * Packs images into an asset pack for SFMLPackImageLoader.
+ *
+ * Usage: gcnpack [--lz4] <output.pack> <image>...
+ *
+ * Every image is decoded with SFML and stored as RGBA pixels under its
+ * normalized path, so it must be given the way the program loads it.
+ * With --lz4 payloads are compressed with LZ4 when that makes them
+ * smaller; it needs the tool built with GCN_SFML_WITH_LZ4.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <guichan/sfml/sfmlassetpack.hpp>
+#include <guichan/sfml/sfmlimageloader.hpp>
+
+#include <SFML/Graphics/Image.hpp>
+
+#ifdef GCN_SFML_WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace
+{
+    const std::size_t PAYLOAD_ALIGNMENT = 16;
+
+    struct PackedImage
+    {
+        std::string name;
+        unsigned int width;
+        unsigned int height;
+        gcn::SFMLAssetPack::Compression compression;
+        std::vector<sf::Uint8> payload;
+    };
+
+    bool compareNames(const PackedImage& a, const PackedImage& b)
+    {
+        return a.name < b.name;
+    }
+
+    std::size_t align(std::size_t offset)
+    {
+        return (offset + PAYLOAD_ALIGNMENT - 1) / PAYLOAD_ALIGNMENT * PAYLOAD_ALIGNMENT;
+    }
+
+    bool packImage(const std::string& filename, bool compress, PackedImage& packed)
+    {
+        sf::Image image;
+
+        if (!image.loadFromFile(filename))
+        {
+            return false;
+        }
+
+        const sf::Uint8* pixels = image.getPixelsPtr();
+        const std::size_t pixelBytes = static_cast<std::size_t>(image.getSize().x) * image.getSize().y * 4;
+
+        packed.name = gcn::SFMLImageLoader::normalizePath(filename);
+        packed.width = image.getSize().x;
+        packed.height = image.getSize().y;
+        packed.compression = gcn::SFMLAssetPack::None;
+        packed.payload.assign(pixels, pixels + pixelBytes);
+
+#ifdef GCN_SFML_WITH_LZ4
+        if (compress && pixelBytes > 0)
+        {
+            std::vector<sf::Uint8> compressed(LZ4_compressBound(static_cast<int>(pixelBytes)));
+
+            const int compressedBytes = LZ4_compress_default(reinterpret_cast<const char*>(pixels),
+                                                             reinterpret_cast<char*>(&compressed[0]),
+                                                             static_cast<int>(pixelBytes),
+                                                             static_cast<int>(compressed.size()));
+
+            if (compressedBytes > 0 && static_cast<std::size_t>(compressedBytes) < pixelBytes)
+            {
+                compressed.resize(compressedBytes);
+                packed.payload.swap(compressed);
+                packed.compression = gcn::SFMLAssetPack::LZ4;
+            }
+        }
+#else
+        (void)compress;
+#endif
+
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool compress = false;
+    int argument = 1;
+
+    if (argument < argc && std::strcmp(argv[argument], "--lz4") == 0)
+    {
+#ifndef GCN_SFML_WITH_LZ4
+        std::fprintf(stderr, "gcnpack was built without GCN_SFML_WITH_LZ4\n");
+        return 1;
+#endif
+        compress = true;
+        argument++;
+    }
+
+    if (argc - argument < 2)
+    {
+        std::fprintf(stderr, "Usage: %s [--lz4] <output.pack> <image>...\n", argv[0]);
+        return 1;
+    }
+
+    const std::string output = argv[argument++];
+    std::vector<PackedImage> images;
+
+    for (; argument < argc; ++argument)
+    {
+        PackedImage packed;
+
+        if (!packImage(argv[argument], compress, packed))
+        {
+            std::fprintf(stderr, "Unable to load image \"%s\"\n", argv[argument]);
+            return 1;
+        }
+
+        images.push_back(packed);
+    }
+
+    std::sort(images.begin(), images.end(), compareNames);
+
+    for (std::size_t i = 1; i < images.size(); ++i)
+    {
+        if (images[i].name == images[i - 1].name)
+        {
+            std::fprintf(stderr, "Image \"%s\" is given twice\n", images[i].name.c_str());
+            return 1;
+        }
+    }
+
+    // Header, index, names, then the payloads.
+    const std::size_t indexSize = gcn::SFMLAssetPack::HEADER_SIZE
+                                  + images.size() * gcn::SFMLAssetPack::ENTRY_SIZE;
+    std::vector<sf::Uint8> index(indexSize, 0);
+
+    gcn::SFMLAssetPack::writeUint32(&index[0], gcn::SFMLAssetPack::MAGIC);
+    gcn::SFMLAssetPack::writeUint32(&index[4], gcn::SFMLAssetPack::VERSION);
+    gcn::SFMLAssetPack::writeUint32(&index[8], static_cast<sf::Uint32>(images.size()));
+
+    std::string names;
+    std::size_t offset = indexSize;
+
+    for (std::size_t i = 0; i < images.size(); ++i)
+    {
+        names += images[i].name;
+    }
+
+    offset += names.size();
+
+    std::size_t nameOffset = indexSize;
+    std::vector<std::size_t> payloadOffsets;
+
+    for (std::size_t i = 0; i < images.size(); ++i)
+    {
+        offset = align(offset);
+        payloadOffsets.push_back(offset);
+
+        sf::Uint8* record = &index[gcn::SFMLAssetPack::HEADER_SIZE + i * gcn::SFMLAssetPack::ENTRY_SIZE];
+        const sf::Uint64 payloadOffset = offset;
+
+        gcn::SFMLAssetPack::writeUint32(record, static_cast<sf::Uint32>(nameOffset));
+        gcn::SFMLAssetPack::writeUint32(record + 4, static_cast<sf::Uint32>(images[i].name.size()));
+        gcn::SFMLAssetPack::writeUint32(record + 8, static_cast<sf::Uint32>(payloadOffset));
+        gcn::SFMLAssetPack::writeUint32(record + 12, static_cast<sf::Uint32>(payloadOffset >> 32));
+        gcn::SFMLAssetPack::writeUint32(record + 16, static_cast<sf::Uint32>(images[i].payload.size()));
+        gcn::SFMLAssetPack::writeUint32(record + 20, images[i].width);
+        gcn::SFMLAssetPack::writeUint32(record + 24, images[i].height);
+        gcn::SFMLAssetPack::writeUint32(record + 28, images[i].compression);
+
+        nameOffset += images[i].name.size();
+        offset += images[i].payload.size();
+    }
+
+    std::ofstream file(output.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+    file.write(reinterpret_cast<const char*>(&index[0]), index.size());
+    file.write(names.data(), names.size());
+
+    std::size_t written = indexSize + names.size();
+    const char padding[PAYLOAD_ALIGNMENT] = { 0 };
+
+    for (std::size_t i = 0; i < images.size(); ++i)
+    {
+        file.write(padding, payloadOffsets[i] - written);
+
+        if (!images[i].payload.empty())
+        {
+            file.write(reinterpret_cast<const char*>(&images[i].payload[0]), images[i].payload.size());
+        }
+
+        written = payloadOffsets[i] + images[i].payload.size();
+    }
+
+    if (!file)
+    {
+        std::fprintf(stderr, "Unable to write \"%s\"\n", output.c_str());
+        return 1;
+    }
+
+    std::printf("Packed %u images into \"%s\" (%u bytes)\n",
+                static_cast<unsigned int>(images.size()),
+                output.c_str(),
+                static_cast<unsigned int>(written));
+
+    return 0;
+}